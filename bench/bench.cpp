@@ -0,0 +1,304 @@
+#include <benchmark/benchmark.h>
+#include <clipboardxx.hpp>
+
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <spawn.h>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// run with `--benchmark_out=<file> --benchmark_out_format=json` for machine readable results, `run_bench` target
+// does that under xvfb-run when it is installed, times are wall clock since most of the work happens in X server,
+// event threads and other processes
+
+extern char** environ;
+
+constexpr const char* kServeArgument = "--serve-clipboard";
+constexpr int64_t kMaxDataSize = 100 * 1000 * 1000;
+
+// another process of this same executable that owns clipboard with `size` bytes of data until it gets destroyed
+class ClipboardOwnerProcess {
+public:
+    explicit ClipboardOwnerProcess(size_t size) {
+        std::array<int, 2> stdin_pipe, stdout_pipe;
+        if (pipe(stdin_pipe.data()) != 0 || pipe(stdout_pipe.data()) != 0)
+            throw std::runtime_error("Cannot create pipes");
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, stdin_pipe[0], STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, stdout_pipe[1], STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, stdin_pipe[1]);
+        posix_spawn_file_actions_addclose(&actions, stdout_pipe[0]);
+
+        std::string size_argument = std::to_string(size);
+        std::array<char*, 4> argv = {const_cast<char*>("bench"), const_cast<char*>(kServeArgument),
+                                     size_argument.data(), nullptr};
+        int error = posix_spawn(&m_pid, "/proc/self/exe", &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(stdin_pipe[0]);
+        close(stdout_pipe[1]);
+        if (error != 0)
+            throw std::runtime_error("Cannot start clipboard owner process");
+
+        // owner writes one byte once it owns clipboard
+        m_stdin = stdin_pipe[1];
+        char ready = 0;
+        ssize_t read_size = read(stdout_pipe[0], &ready, 1);
+        close(stdout_pipe[0]);
+        if (read_size != 1)
+            throw std::runtime_error("Clipboard owner process failed");
+    }
+
+    ~ClipboardOwnerProcess() {
+        close(m_stdin);
+        waitpid(m_pid, nullptr, 0);
+    }
+
+    // owns clipboard until stdin gets closed
+    static int serve(size_t size) {
+        clipboardxx::clipboard clipboard;
+        clipboard.copy(std::string(size, 'x'));
+        if (write(STDOUT_FILENO, "1", 1) != 1)
+            return EXIT_FAILURE;
+
+        char ignored;
+        while (read(STDIN_FILENO, &ignored, 1) > 0) {
+        }
+        return EXIT_SUCCESS;
+    }
+
+private:
+    pid_t m_pid = 0;
+    int m_stdin = -1;
+};
+
+// 1 byte to 100 MB
+static void use_data_sizes(benchmark::internal::Benchmark* benchmark) {
+    benchmark->RangeMultiplier(100)->Range(1, kMaxDataSize)->Unit(benchmark::kMicrosecond)->UseRealTime();
+}
+
+static void construct_clipboard(benchmark::State &state) {
+    for (auto _ : state) {
+        clipboardxx::clipboard clipboard;
+        benchmark::DoNotOptimize(clipboard);
+    }
+}
+BENCHMARK(construct_clipboard)->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+static void construct_and_warm_up_clipboard(benchmark::State &state) {
+    for (auto _ : state) {
+        clipboardxx::clipboard clipboard;
+        clipboard.warm_up();
+    }
+}
+BENCHMARK(construct_and_warm_up_clipboard)->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+static void construct_clipboard_with_shared_backend(benchmark::State &state) {
+    clipboardxx::options opts;
+    opts.shared_backend = true;
+    const clipboardxx::clipboard first_clipboard(opts);
+    first_clipboard.warm_up();
+
+    for (auto _ : state) {
+        clipboardxx::clipboard clipboard(opts);
+        clipboard.warm_up();
+    }
+}
+BENCHMARK(construct_clipboard_with_shared_backend)->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+static void copy_text(benchmark::State &state) {
+    const clipboardxx::clipboard clipboard;
+    const std::string text(state.range(0), 'x');
+
+    for (auto _ : state)
+        clipboard.copy(text);
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(copy_text)->Apply(use_data_sizes);
+
+// nothing of the file gets read, unlike `copy_text` which needs the whole data in memory first
+static void copy_file(benchmark::State &state) {
+    const clipboardxx::clipboard clipboard;
+    char path[] = "/tmp/clipboardxx_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || ftruncate(fd, state.range(0)) != 0) {
+        state.SkipWithError("cannot create file");
+        return;
+    }
+    close(fd);
+
+    for (auto _ : state)
+        clipboard.copy_file(path);
+    unlink(path);
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(copy_file)->Apply(use_data_sizes);
+
+static void paste_as_owner(benchmark::State &state) {
+    const clipboardxx::clipboard clipboard;
+    clipboard.copy(std::string(state.range(0), 'x'));
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(clipboard.paste_buffer());
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(paste_as_owner)->Apply(use_data_sizes);
+
+static void paste_from_same_process(benchmark::State &state) {
+    const clipboardxx::clipboard owner, clipboard;
+    owner.copy(std::string(state.range(0), 'x'));
+
+    for (auto _ : state) {
+        clipboardxx::buffer data = clipboard.paste_buffer();
+        if (data.size() != static_cast<size_t>(state.range(0)))
+            state.SkipWithError("pasted data has wrong size");
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(paste_from_same_process)->Apply(use_data_sizes);
+
+static void paste_from_another_process(benchmark::State &state) {
+    const ClipboardOwnerProcess owner(state.range(0));
+    const clipboardxx::clipboard clipboard;
+
+    for (auto _ : state) {
+        clipboardxx::buffer data = clipboard.paste_buffer();
+        if (data.size() != static_cast<size_t>(state.range(0)))
+            state.SkipWithError("pasted data has wrong size");
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(paste_from_another_process)->Apply(use_data_sizes);
+
+// every requestor has its own connection, so owner serves all of them at the same time
+static void serve_concurrent_requestors(benchmark::State &state) {
+    constexpr size_t data_size = 64 * 1024;
+    const clipboardxx::clipboard owner;
+    owner.copy(std::string(data_size, 'x'));
+
+    std::vector<std::unique_ptr<clipboardxx::clipboard>> requestors;
+    for (int64_t i = 0; i < state.range(0); i++)
+        requestors.push_back(std::make_unique<clipboardxx::clipboard>());
+
+    for (auto _ : state) {
+        std::vector<std::future<std::string>> results;
+        for (const std::unique_ptr<clipboardxx::clipboard> &requestor : requestors)
+            results.push_back(requestor->paste_async(std::chrono::seconds(10)));
+        for (std::future<std::string> &result : results)
+            if (result.get().size() != data_size)
+                state.SkipWithError("pasted data has wrong size");
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(serve_concurrent_requestors)->RangeMultiplier(4)->Range(1, 64)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// clipboard as it is on hosts without X server, shared with other processes through shared memory
+static std::unique_ptr<clipboardxx::clipboard> make_headless_clipboard() {
+    const char* display = std::getenv("DISPLAY");
+    const std::string saved_display = display ? display : "";
+    unsetenv("DISPLAY");
+    auto clipboard = std::make_unique<clipboardxx::clipboard>();
+    if (display)
+        setenv("DISPLAY", saved_display.c_str(), 1);
+    return clipboard;
+}
+
+static void copy_text_headless(benchmark::State &state) {
+    const std::unique_ptr<clipboardxx::clipboard> clipboard = make_headless_clipboard();
+    const clipboardxx::buffer data(std::string(state.range(0), 'x'));
+
+    for (auto _ : state)
+        clipboard->copy(data);
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+    // data would stay in /dev/shm otherwise
+    clipboard->copy(std::string());
+}
+BENCHMARK(copy_text_headless)->Apply(use_data_sizes);
+
+// every paste of the same copy shares one mapping, so only the first one costs syscalls
+static void paste_headless(benchmark::State &state) {
+    const std::unique_ptr<clipboardxx::clipboard> owner = make_headless_clipboard(),
+                                                  clipboard = make_headless_clipboard();
+    owner->copy(std::string(state.range(0), 'x'));
+
+    for (auto _ : state) {
+        clipboardxx::buffer data = clipboard->paste_buffer();
+        if (data.size() != static_cast<size_t>(state.range(0)))
+            state.SkipWithError("pasted data has wrong size");
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+    owner->copy(std::string());
+}
+BENCHMARK(paste_headless)->Apply(use_data_sizes);
+
+constexpr size_t kEncodingTextSize = 8 * 1000 * 1000;
+
+// mostly ASCII like source code or english text when `non_ascii_every` is big, every character needs decoding when
+// it is 1
+static std::string make_utf8_text(size_t non_ascii_every) {
+    std::string text;
+    text.reserve(kEncodingTextSize + 2);
+    for (size_t i = 0; text.size() < kEncodingTextSize; i++)
+        text += i % non_ascii_every == non_ascii_every - 1 ? "\xC3\xA9" : "e";
+    return text;
+}
+
+static void count_ascii_scalar(benchmark::State &state) {
+    const std::string text(kEncodingTextSize, 'e');
+    for (auto _ : state)
+        benchmark::DoNotOptimize(clipboardxx::count_ascii_scalar(text.data(), text.size()));
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(count_ascii_scalar)->Unit(benchmark::kMicrosecond);
+
+static void count_ascii_simd(benchmark::State &state) {
+    const std::string text(kEncodingTextSize, 'e');
+    for (auto _ : state)
+        benchmark::DoNotOptimize(clipboardxx::count_ascii(text.data(), text.size()));
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(count_ascii_simd)->Unit(benchmark::kMicrosecond);
+
+// argument is how often a non ASCII character shows up
+static void validate_utf8(benchmark::State &state) {
+    const std::string text = make_utf8_text(state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(clipboardxx::is_valid_utf8(text));
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(validate_utf8)->Arg(1)->Arg(100)->Arg(10000)->Unit(benchmark::kMicrosecond);
+
+static void utf8_to_latin1(benchmark::State &state) {
+    const std::string text = make_utf8_text(state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(clipboardxx::utf8_to_latin1(text));
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(utf8_to_latin1)->Arg(1)->Arg(100)->Arg(10000)->Unit(benchmark::kMicrosecond);
+
+static void latin1_to_utf8(benchmark::State &state) {
+    const std::string text = clipboardxx::utf8_to_latin1(make_utf8_text(state.range(0)));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(clipboardxx::latin1_to_utf8(text));
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(latin1_to_utf8)->Arg(1)->Arg(100)->Arg(10000)->Unit(benchmark::kMicrosecond);
+
+int main(int argc, char** argv) {
+    if (argc == 3 && std::strcmp(argv[1], kServeArgument) == 0)
+        return ClipboardOwnerProcess::serve(std::stoul(argv[2]));
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return EXIT_FAILURE;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return EXIT_SUCCESS;
+}
@@ -1,41 +1,252 @@
-#pragma once
-
-#include "detail/interface.hpp"
-#if defined(_WIN32) || defined(WIN32)
-    #define WINDOWS
-    #include "detail/windows.hpp"
-#elif defined(__linux__)
-    #define LINUX
-    #include "detail/linux.hpp"
-#else
-    #error "platform not supported"
-#endif
-
-#include <memory>
-#include <string>
-
-namespace clipboardxx {
-
-#ifdef WINDOWS
-using ClipboardType = ClipboardWindows;
-#elif defined(LINUX)
-using ClipboardType = ClipboardLinux;
-#endif
-
-class clipboard {
-public:
-    clipboard() : m_clipboard(std::make_unique<ClipboardType>()) {}
-
-    void operator<<(const std::string &text) const { copy(text); }
-
-    void copy(const std::string &text) const { m_clipboard->copy(text); }
-
-    void operator>>(std::string &result) const { result = paste(); }
-
-    std::string paste() const { return m_clipboard->paste(); }
-
-private:
-    std::unique_ptr<ClipboardInterface> m_clipboard;
-};
-
-} // namespace clipboardxx
+#pragma once
+
+#include "detail/async.hpp"
+#include "detail/buffer.hpp"
+#include "detail/exception.hpp"
+#include "detail/interface.hpp"
+#include "detail/options.hpp"
+#include "detail/stats.hpp"
+#if defined(_WIN32) || defined(WIN32)
+    #define WINDOWS
+    #include "detail/windows.hpp"
+#elif defined(__linux__)
+    #define LINUX
+    #include "detail/linux.hpp"
+#else
+    #error "platform not supported"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#ifdef LINUX
+    #include <cerrno>
+    #include <unistd.h>
+#endif
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+    #include <coroutine>
+    #define CLIPBOARDXX_COROUTINES
+#endif
+
+namespace clipboardxx {
+
+#ifdef WINDOWS
+using ClipboardType = ClipboardWindows;
+#elif defined(LINUX)
+using ClipboardType = ClipboardLinux;
+#endif
+
+class clipboard {
+public:
+    // cheap, connecting to the platform clipboard is left to the first operation
+    explicit clipboard(const options &opts = options()) : m_clipboard(std::make_unique<ClipboardType>(opts)) {}
+
+    // connects right away so the first operation doesn't pay for it, useful for latency sensitive callers, throws
+    // when connecting fails
+    void warm_up() const { m_clipboard->warm_up(); }
+
+    void operator<<(const std::string &text) const { copy(text); }
+
+    void copy(const std::string &text) const { copy(buffer(std::string(text))); }
+
+    // overloads below take ownership of data instead of copying it
+
+    void copy(std::string &&text) const { copy(buffer(std::move(text))); }
+
+    void copy(std::shared_ptr<const std::string> text) const { copy(buffer(std::move(text))); }
+
+    void copy(const char* data, size_t size, std::function<void(const char*)> deleter) const {
+        copy(buffer(data, size, std::move(deleter)));
+    }
+
+    void copy(buffer data) const { m_clipboard->copy(std::move(data)); }
+
+    // offers several formats at once (e.g. "text/html" next to "text/plain"), pasting applications pick the one they
+    // understand best, text given under any text mime type is pasted by `paste` as well
+    void copy(std::vector<mime_data> formats) const { m_clipboard->copy(std::move(formats)); }
+
+    // data of each format is only produced when somebody pastes it, so copying big documents costs nothing until
+    // then (on X11, Windows produces all of them right away)
+    void copy(std::vector<lazy_mime_data> formats) const { m_clipboard->copy(std::move(formats)); }
+
+    // offers content of the file under `mime_type`, on X11 the file is mapped into memory instead of being read so
+    // copying costs nothing until somebody pastes it, file must not get truncated while clipboard offers it
+    void copy_file(const std::string &path, const std::string &mime_type = "text/plain") const {
+        m_clipboard->copy_file(path, mime_type);
+    }
+
+    void operator>>(std::string &result) const { paste(result); }
+
+    std::string paste() const { return m_clipboard->paste().to_string(); }
+
+    // reuses memory of `result` if it has enough capacity
+    void paste(std::string &result) const {
+        const buffer data = m_clipboard->paste();
+        result.assign(data.data(), data.size());
+    }
+
+    // writes at most `capacity` bytes to `destination` and returns the full size of clipboard data, so the caller
+    // can tell if its memory was not big enough
+    size_t paste(char* destination, size_t capacity) const {
+        const buffer data = m_clipboard->paste();
+        std::copy_n(data.data(), std::min(capacity, data.size()), destination);
+        return data.size();
+    }
+
+    // same data as `paste` but shares the memory instead of copying it whenever possible
+    buffer paste_buffer() const { return m_clipboard->paste(); }
+
+    // data of one format byte by byte, empty when clipboard doesn't offer `mime_type`
+    std::string paste_mime(const std::string &mime_type) const { return m_clipboard->paste(mime_type).to_string(); }
+
+    buffer paste_buffer(const std::string &mime_type) const { return m_clipboard->paste(mime_type); }
+
+    // data of several formats at once in the order they are given, on X11 it takes a single exchange with
+    // clipboard owner (ICCCM MULTIPLE target) instead of one for each format
+    std::vector<mime_data> paste_mimes(const std::vector<std::string> &mime_types) const {
+        std::vector<buffer> data = m_clipboard->paste(mime_types);
+        std::vector<mime_data> result;
+        for (size_t i = 0; i < mime_types.size(); i++)
+            result.push_back(mime_data{mime_types.at(i), std::move(data.at(i))});
+        return result;
+    }
+
+    // data of `mime_type` (text when empty) is handed to `sink` piece by piece as it arrives, so on X11 pasting big
+    // data never needs more memory than one piece of it, the number of bytes written is returned, an owner that
+    // stops sending halfway throws `timeout_exception`
+    size_t paste_to(const paste_sink &sink, const std::string &mime_type = std::string()) const {
+        return m_clipboard->paste(sink, mime_type);
+    }
+
+    size_t paste_to(std::ostream &stream, const std::string &mime_type = std::string()) const {
+        return paste_to(
+            [&stream](const char* data, size_t size) {
+                if (!stream.write(data, static_cast<std::streamsize>(size)))
+                    throw exception("Cannot write paste data to stream");
+            },
+            mime_type);
+    }
+
+#ifdef LINUX
+    size_t paste_to(int fd, const std::string &mime_type = std::string()) const {
+        return paste_to(
+            [fd](const char* data, size_t size) {
+                while (size != 0) {
+                    ssize_t written = write(fd, data, size);
+                    if (written < 0 && errno == EINTR)
+                        continue;
+                    if (written <= 0)
+                        throw exception("Cannot write paste data to file descriptor");
+                    data += written;
+                    size -= static_cast<size_t>(written);
+                }
+            },
+            mime_type);
+    }
+#endif
+
+    // asynchronous operations don't block the caller, callbacks get called on the clipboard event thread (or
+    // before returning when the result is available right away) and must not call blocking `paste` themselves
+
+    std::future<void> copy_async(buffer data) const {
+        std::shared_ptr<std::promise<void>> promise = std::make_shared<std::promise<void>>();
+        std::future<void> result = promise->get_future();
+        copy_async(std::move(data), [promise](std::exception_ptr error) {
+            if (error)
+                promise->set_exception(error);
+            else
+                promise->set_value();
+        });
+        return result;
+    }
+
+    std::future<void> copy_async(std::string text) const { return copy_async(buffer(std::move(text))); }
+
+    void copy_async(buffer data, copy_callback callback) const {
+        m_clipboard->copy_async(std::move(data), std::move(callback));
+    }
+
+    // unlike `paste`, running out of time is reported with `timeout_exception`
+    std::future<std::string> paste_async(std::chrono::milliseconds timeout = kWaitForPasteDataTimeout,
+                                         cancellation cancel = cancellation()) const {
+        std::shared_ptr<std::promise<std::string>> promise = std::make_shared<std::promise<std::string>>();
+        std::future<std::string> result = promise->get_future();
+        paste_async(
+            [promise](std::exception_ptr error, buffer data) {
+                if (error)
+                    promise->set_exception(error);
+                else
+                    promise->set_value(std::move(data).to_string());
+            },
+            timeout, std::move(cancel));
+        return result;
+    }
+
+    void paste_async(paste_callback callback, std::chrono::milliseconds timeout = kWaitForPasteDataTimeout,
+                     cancellation cancel = cancellation()) const {
+        m_clipboard->paste_async(std::move(callback), timeout, std::move(cancel));
+    }
+
+    // calls `callback` on clipboard event thread whenever clipboard gets a new owner until `cancel` gets cancelled,
+    // which is cheaper than pasting over and over to find out, false is returned when platform can't report
+    // changes (X11 servers without XFixes extension and Windows)
+    bool on_change(change_callback callback, cancellation cancel = cancellation()) const {
+        return m_clipboard->on_change(std::move(callback), std::move(cancel));
+    }
+
+    // counters and latency histograms of everything done so far (X11 only), cheap enough to call every now and then
+    stats get_stats() const { return m_clipboard->get_stats(); }
+
+#ifdef CLIPBOARDXX_COROUTINES
+    // `co_await clipboard.paste_awaitable()` resumes the coroutine on the clipboard event thread
+    class paste_awaitable_type {
+    public:
+        paste_awaitable_type(const ClipboardInterface &clipboard, std::chrono::milliseconds timeout,
+                             cancellation cancel)
+            : m_clipboard(clipboard), m_timeout(timeout), m_cancel(std::move(cancel)) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        // callback may resume the coroutine before `paste_async` returns, nothing of `this` is used afterwards
+        void await_suspend(std::coroutine_handle<> handle) {
+            m_clipboard.paste_async(
+                [this, handle](std::exception_ptr error, buffer data) {
+                    m_error = error;
+                    m_data = std::move(data);
+                    handle.resume();
+                },
+                m_timeout, m_cancel);
+        }
+
+        std::string await_resume() {
+            if (m_error)
+                std::rethrow_exception(m_error);
+            return std::move(m_data).to_string();
+        }
+
+    private:
+        const ClipboardInterface &m_clipboard;
+        std::chrono::milliseconds m_timeout;
+        cancellation m_cancel;
+        std::exception_ptr m_error;
+        buffer m_data;
+    };
+
+    paste_awaitable_type paste_awaitable(std::chrono::milliseconds timeout = kWaitForPasteDataTimeout,
+                                         cancellation cancel = cancellation()) const {
+        return paste_awaitable_type(*m_clipboard, timeout, std::move(cancel));
+    }
+#endif
+
+private:
+    std::unique_ptr<ClipboardInterface> m_clipboard;
+};
+
+} // namespace clipboardxx
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "buffer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace clipboardxx {
+
+constexpr std::chrono::milliseconds kWaitForPasteDataTimeout = std::chrono::milliseconds(300);
+
+// `error` is null when operation succeeds, otherwise it holds `timeout_exception`, `cancelled_exception` or any
+// other `exception` that the operation failed with
+using paste_callback = std::function<void(std::exception_ptr error, buffer data)>;
+using copy_callback = std::function<void(std::exception_ptr error)>;
+
+// gets pasted data piece by piece in order, throwing stops the paste and the exception reaches its caller
+using paste_sink = std::function<void(const char* data, size_t size)>;
+
+// clipboard got a new content, nothing of it is transferred until somebody pastes it
+struct change_event {
+    uint32_t owner;     // X11 window of the new owner, zero when nobody owns clipboard anymore, without X server
+                        // it is the pid of the copying process
+    uint32_t timestamp; // X server time at which owner took the clipboard, milliseconds of wall clock without it
+};
+
+using change_callback = std::function<void(const change_event &event)>;
+
+// cancelling makes every operation that was started with this object fail with `cancelled_exception`, unless the
+// operation is already finished, copies of the object share the same state
+class cancellation {
+public:
+    cancellation() : m_state(std::make_shared<State>()) {}
+
+    void cancel() const {
+        std::vector<std::pair<uint64_t, std::function<void()>>> listeners;
+        {
+            std::lock_guard<std::mutex> lock_guard(m_state->lock);
+            m_state->cancelled = true;
+            listeners.swap(m_state->listeners);
+        }
+
+        for (const auto &listener : listeners)
+            listener.second();
+    }
+
+    bool is_cancelled() const { return m_state->cancelled; }
+
+    // listener is called once when `cancel` gets called, or right away if it already has been, returned
+    // registration can be passed to `remove_listener` once the operation no longer cares, zero means the listener
+    // has already been called
+    uint64_t on_cancel(std::function<void()> listener) const {
+        {
+            std::lock_guard<std::mutex> lock_guard(m_state->lock);
+            if (!m_state->cancelled) {
+                uint64_t registration = ++m_state->last_registration;
+                m_state->listeners.emplace_back(registration, std::move(listener));
+                return registration;
+            }
+        }
+        listener();
+        return 0;
+    }
+
+    // does nothing when the listener has already been called or removed
+    void remove_listener(uint64_t registration) const {
+        std::lock_guard<std::mutex> lock_guard(m_state->lock);
+        std::vector<std::pair<uint64_t, std::function<void()>>> &listeners = m_state->listeners;
+        listeners.erase(std::remove_if(listeners.begin(), listeners.end(),
+                                       [registration](const auto &listener) { return listener.first == registration; }),
+                        listeners.end());
+    }
+
+private:
+    struct State {
+        std::atomic<bool> cancelled = false;
+        std::mutex lock;
+        uint64_t last_registration = 0;
+        std::vector<std::pair<uint64_t, std::function<void()>>> listeners;
+    };
+
+    std::shared_ptr<State> m_state;
+};
+
+} // namespace clipboardxx
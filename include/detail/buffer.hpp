@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace clipboardxx {
+
+// immutable bytes that are shared instead of copied, whatever owns the memory is kept alive as long as any
+// copy of the buffer exists
+class buffer {
+public:
+    buffer() : buffer(std::string()) {}
+
+    explicit buffer(std::string &&data) {
+        std::shared_ptr<std::string> owner = std::make_shared<std::string>(std::move(data));
+        m_string = owner.get();
+        m_data = owner->data();
+        m_size = owner->size();
+        m_owner = std::move(owner);
+    }
+
+    explicit buffer(std::shared_ptr<const std::string> data)
+        : m_data(data->data()), m_size(data->size()), m_owner(std::move(data)) {}
+
+    // deleter gets called with `data` once the last copy of buffer is destroyed
+    buffer(const char* data, size_t size, std::function<void(const char*)> deleter)
+        : m_data(data), m_size(size), m_owner(std::shared_ptr<const char>(data, std::move(deleter))) {}
+
+    const char* data() const { return m_data; }
+
+    size_t size() const { return m_size; }
+
+    bool empty() const { return m_size == 0; }
+
+    std::string_view view() const { return std::string_view(m_data, m_size); }
+
+    std::string to_string() const & { return std::string(m_data, m_size); }
+
+    // steals the string instead of copying it when buffer was made from one and nobody else shares it
+    std::string to_string() && {
+        if (m_string == nullptr || m_owner.use_count() != 1)
+            return std::string(m_data, m_size);
+
+        std::string result = std::move(*m_string);
+        m_data = m_string->data();
+        m_size = m_string->size();
+        return result;
+    }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    std::shared_ptr<const void> m_owner;
+    std::string* m_string = nullptr;
+};
+
+// data of one format offered through clipboard, on X11 mime type can be any target name as well
+struct mime_data {
+    std::string mime_type;
+    buffer data;
+};
+
+// makes data of a format only when somebody pastes it, gets called on clipboard event thread while it is busy so it
+// must not use the clipboard itself
+using data_producer = std::function<buffer()>;
+
+struct lazy_mime_data {
+    std::string mime_type;
+    data_producer producer;
+    // keep the produced data for later pastes instead of calling producer again
+    bool memoize = true;
+};
+
+} // namespace clipboardxx
@@ -10,4 +10,14 @@ public:
     exception(const std::string &reason) : std::runtime_error(reason){};
 };
 
+class timeout_exception : public exception {
+public:
+    timeout_exception() : exception("Clipboard operation timed out"){};
+};
+
+class cancelled_exception : public exception {
+public:
+    cancelled_exception() : exception("Clipboard operation got cancelled"){};
+};
+
 } // namespace clipboardxx
@@ -1,14 +1,98 @@
 #pragma once
 
+#include "async.hpp"
+#include "buffer.hpp"
+#include "exception.hpp"
+#include "stats.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <iterator>
 #include <string>
+#include <vector>
 
 namespace clipboardxx {
 
 class ClipboardInterface {
 public:
     virtual ~ClipboardInterface() = default;
-    virtual void copy(const std::string &text) const = 0;
-    virtual std::string paste() const = 0;
+    virtual void copy(buffer data) const = 0;
+    virtual void copy(std::vector<mime_data> formats) const = 0;
+    virtual buffer paste() const = 0;
+    virtual buffer paste(const std::string &mime_type) const = 0;
+
+    // platforms that have nothing to set up beforehand ignore it
+    virtual void warm_up() const {}
+
+    // false is returned when platform can't report clipboard changes
+    virtual bool on_change(change_callback /*callback*/, cancellation /*cancel*/) const { return false; }
+
+    // platforms without instrumentation report nothing
+    virtual stats get_stats() const { return stats(); }
+
+    // platforms without batched requests paste formats one by one
+    virtual std::vector<buffer> paste(const std::vector<std::string> &mime_types) const {
+        std::vector<buffer> result;
+        for (const std::string &mime_type : mime_types)
+            result.push_back(paste(mime_type));
+        return result;
+    }
+
+    // platforms without streaming transfers paste everything first and hand it to sink at once
+    virtual size_t paste(const paste_sink &sink, const std::string &mime_type) const {
+        const buffer data = paste(mime_type);
+        if (!data.empty())
+            sink(data.data(), data.size());
+        return data.size();
+    }
+
+    // platforms that have to copy data into their own memory anyway just read the file
+    virtual void copy_file(const std::string &path, const std::string &mime_type) const {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            throw exception("Cannot open " + path);
+        std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        copy(std::vector<mime_data>{mime_data{mime_type, buffer(std::move(data))}});
+    }
+
+    // platforms without delayed rendering produce everything right away
+    virtual void copy(std::vector<lazy_mime_data> formats) const {
+        std::vector<mime_data> produced;
+        for (const lazy_mime_data &format : formats)
+            produced.push_back(mime_data{format.mime_type, format.producer()});
+        copy(std::move(produced));
+    }
+
+    // platforms without a native asynchronous api just do the operation and call the callback before returning
+
+    virtual void copy_async(buffer data, copy_callback callback) const {
+        std::exception_ptr error = nullptr;
+        try {
+            copy(std::move(data));
+        } catch (...) {
+            error = std::current_exception();
+        }
+        callback(error);
+    }
+
+    virtual void paste_async(paste_callback callback, std::chrono::milliseconds /*timeout*/,
+                             cancellation cancel) const {
+        if (cancel.is_cancelled()) {
+            callback(std::make_exception_ptr(cancelled_exception()), buffer());
+            return;
+        }
+
+        std::exception_ptr error = nullptr;
+        buffer data;
+        try {
+            data = paste();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        callback(error, std::move(data));
+    }
 };
 
 } // namespace clipboardxx
@@ -3,26 +3,172 @@
 #ifdef LINUX
     #include "exception.hpp"
     #include "interface.hpp"
+    #include "linux/mapped_file.hpp"
+    #include "linux/shared_memory_provider.hpp"
     #include "linux/x11_provider.hpp"
+    #include "options.hpp"
+
+    #include <cstdlib>
 
 namespace clipboardxx {
 
 class ClipboardLinux : public ClipboardInterface {
 public:
-    ClipboardLinux() : m_provider(std::make_unique<X11Provider>()) {}
+    // hosts without X server (build machines, containers ...) still get a clipboard, shared by the processes of
+    // the user through shared memory
+    explicit ClipboardLinux(const options &opts) {
+        const char* display = std::getenv("DISPLAY");
+        if (display == nullptr || display[0] == '\0') {
+            m_provider = std::make_unique<SharedMemoryProvider>(opts);
+            m_error_prefix = "Shared memory Error: ";
+        } else {
+            auto provider = std::make_unique<X11Provider>(opts);
+            m_async_provider = provider.get();
+            m_provider = std::move(provider);
+            m_error_prefix = "XCB Error: ";
+        }
+    }
+
+    void warm_up() const override {
+        try {
+            m_provider->warm_up();
+        } catch (const exception &error) {
+            throw exception(m_error_prefix + std::string(error.what()));
+        }
+    }
+
+    void copy(buffer data) const override {
+        try {
+            m_provider->copy(std::move(data));
+        } catch (const exception &error) {
+            throw exception(m_error_prefix + std::string(error.what()));
+        }
+    }
+
+    void copy(std::vector<mime_data> formats) const override {
+        try {
+            m_provider->copy(std::move(formats));
+        } catch (const exception &error) {
+            throw exception(m_error_prefix + std::string(error.what()));
+        }
+    }
+
+    // requests are served straight from the mapping, so nothing of the file is read until somebody pastes it
+    void copy_file(const std::string &path, const std::string &mime_type) const override {
+        copy(std::vector<mime_data>{mime_data{mime_type, map_file(path)}});
+    }
+
+    void copy_async(buffer data, copy_callback callback) const override {
+        if (m_async_provider == nullptr) {
+            ClipboardInterface::copy_async(std::move(data), std::move(callback));
+            return;
+        }
+
+        m_async_provider->copy_async(
+            std::move(data), [callback = std::move(callback), prefix = m_error_prefix](std::exception_ptr error) {
+                callback(add_error_prefix(error, prefix));
+            });
+    }
+
+    void copy(std::vector<lazy_mime_data> formats) const override {
+        if (m_async_provider == nullptr) {
+            ClipboardInterface::copy(std::move(formats));
+            return;
+        }
+
+        try {
+            m_async_provider->copy(std::move(formats));
+        } catch (const exception &error) {
+            throw exception(m_error_prefix + std::string(error.what()));
+        }
+    }
+
+    buffer paste() const override {
+        try {
+            return m_provider->paste();
+        } catch (const exception &error) {
+            throw exception(m_error_prefix + std::string(error.what()));
+        }
+    }
+
+    buffer paste(const std::string &mime_type) const override {
+        try {
+            return m_provider->paste(mime_type);
+        } catch (const exception &error) {
+            throw exception(m_error_prefix + std::string(error.what()));
+        }
+    }
+
+    std::vector<buffer> paste(const std::vector<std::string> &mime_types) const override {
+        try {
+            return m_provider->paste(mime_types);
+        } catch (const exception &error) {
+            throw exception(m_error_prefix + std::string(error.what()));
+        }
+    }
+
+    // owner that stops sending halfway is reported with its own type, like timeouts of asynchronous pastes
+    size_t paste(const paste_sink &sink, const std::string &mime_type) const override {
+        try {
+            return m_provider->paste(sink, mime_type);
+        } catch (const timeout_exception &) {
+            throw;
+        } catch (const exception &error) {
+            throw exception(m_error_prefix + std::string(error.what()));
+        }
+    }
+
+    void paste_async(paste_callback callback, std::chrono::milliseconds timeout,
+                     cancellation cancel) const override {
+        if (m_async_provider == nullptr) {
+            ClipboardInterface::paste_async(std::move(callback), timeout, std::move(cancel));
+            return;
+        }
+
+        m_async_provider->paste_async(
+            [callback = std::move(callback), prefix = m_error_prefix](std::exception_ptr error, buffer data) {
+                callback(add_error_prefix(error, prefix), std::move(data));
+            },
+            timeout, std::move(cancel));
+    }
 
-    void copy(const std::string &text) const override {
+    bool on_change(change_callback callback, cancellation cancel) const override {
         try {
-            m_provider->copy(text);
+            return m_provider->on_change(std::move(callback), std::move(cancel));
         } catch (const exception &error) {
-            throw exception("XCB Error: " + std::string(error.what()));
+            throw exception(m_error_prefix + std::string(error.what()));
         }
     }
 
-    std::string paste() const override { return m_provider->paste(); }
+    stats get_stats() const override {
+        try {
+            return m_provider->get_stats();
+        } catch (const exception &error) {
+            throw exception(m_error_prefix + std::string(error.what()));
+        }
+    }
 
 private:
-    const std::unique_ptr<LinuxClipboardProvider> m_provider;
+    static std::exception_ptr add_error_prefix(std::exception_ptr error, const std::string &prefix) {
+        if (!error)
+            return error;
+
+        try {
+            std::rethrow_exception(error);
+        } catch (const timeout_exception &) {
+            return error;
+        } catch (const cancelled_exception &) {
+            return error;
+        } catch (const exception &provider_error) {
+            return std::make_exception_ptr(exception(prefix + std::string(provider_error.what())));
+        } catch (...) {
+            return std::current_exception();
+        }
+    }
+
+    std::unique_ptr<LinuxClipboardProvider> m_provider;
+    LinuxAsyncClipboardProvider* m_async_provider = nullptr; // same object as `m_provider` when it has native support
+    std::string m_error_prefix;
 };
 
 } // namespace clipboardxx
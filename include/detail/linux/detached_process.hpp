@@ -0,0 +1,76 @@
+#pragma once
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+namespace clipboardxx {
+
+constexpr int kDetachedProcessReadyTimeoutMs = 2000;
+
+// inherited files other than `keep_fd` would keep pipes of the parent (e.g. shell command substitution) open
+inline void detach_from_inherited_files(int keep_fd) {
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+        for (int fd = 0; fd < 3; fd++)
+            dup2(null_fd, fd);
+    }
+
+    std::vector<int> inherited_fds;
+    if (DIR* fds_dir = opendir("/proc/self/fd")) {
+        while (dirent* entry = readdir(fds_dir)) {
+            int fd = std::atoi(entry->d_name);
+            if (fd > 2 && fd != keep_fd && fd != dirfd(fds_dir))
+                inherited_fds.push_back(fd);
+        }
+        closedir(fds_dir);
+    }
+    for (int fd : inherited_fds)
+        close(fd);
+}
+
+// process gets adopted by init so it never becomes a zombie, false is returned when `body` doesn't call `ready` in time
+inline bool run_in_detached_process(const std::function<void(const std::function<void()> &ready)> &body) {
+    int ready_pipe[2];
+    if (pipe2(ready_pipe, O_CLOEXEC) != 0)
+        return false;
+
+    pid_t child = fork();
+    if (child == 0) {
+        // only the forking thread exists here, nothing that another thread may have locked can be used
+        if (setsid() < 0 || fork() != 0)
+            _exit(0);
+
+        close(ready_pipe[0]);
+        detach_from_inherited_files(ready_pipe[1]);
+        int status = 0;
+        try {
+            body([ready_fd = ready_pipe[1]] {
+                const char byte = 1;
+                [[maybe_unused]] ssize_t written = write(ready_fd, &byte, 1);
+            });
+        } catch (...) {
+            status = 1;
+        }
+        _exit(status);
+    }
+
+    close(ready_pipe[1]);
+    bool ready = false;
+    if (child > 0) {
+        waitpid(child, nullptr, 0);
+        pollfd ready_fd{.fd = ready_pipe[0], .events = POLLIN, .revents = 0};
+        char byte = 0;
+        ready = poll(&ready_fd, 1, kDetachedProcessReadyTimeoutMs) > 0 && read(ready_pipe[0], &byte, 1) == 1;
+    }
+    close(ready_pipe[0]);
+    return ready;
+}
+
+} // namespace clipboardxx
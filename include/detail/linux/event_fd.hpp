@@ -0,0 +1,47 @@
+#pragma once
+
+#include "../exception.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace clipboardxx {
+
+class EventFd {
+public:
+    EventFd() : m_fd(create_event_fd()) {}
+
+    ~EventFd() { close(m_fd); }
+
+    EventFd(const EventFd &) = delete;
+    EventFd &operator=(const EventFd &) = delete;
+
+    int get() const { return m_fd; }
+
+    void notify() const {
+        uint64_t value = 1;
+        // counter can only overflow after 2^64 - 1 notifies without drain, safe to ignore result
+        [[maybe_unused]] ssize_t written_bytes = write(m_fd, &value, sizeof(value));
+    }
+
+    void drain() const {
+        uint64_t value = 0;
+        [[maybe_unused]] ssize_t read_bytes = read(m_fd, &value, sizeof(value));
+    }
+
+private:
+    static int create_event_fd() {
+        int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (fd < 0)
+            throw exception("Cannot create eventfd (" + std::string(std::strerror(errno)) + ")");
+        return fd;
+    }
+
+    const int m_fd;
+};
+
+} // namespace clipboardxx
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "../buffer.hpp"
+#include "../exception.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace clipboardxx {
+
+// truncating the file while it is mapped makes reading past its new end kill the process with SIGBUS
+inline buffer map_file(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw exception("Cannot open " + path + " (" + std::string(std::strerror(errno)) + ")");
+
+    struct stat file_stat {};
+    if (fstat(fd, &file_stat) != 0) {
+        int error = errno;
+        close(fd);
+        throw exception("Cannot get size of " + path + " (" + std::string(std::strerror(error)) + ")");
+    }
+
+    // empty files can't be mapped, there is nothing to share anyway
+    size_t size = static_cast<size_t>(file_stat.st_size);
+    if (size == 0) {
+        close(fd);
+        return buffer();
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int error = errno;
+    // mapping keeps the file open by itself
+    close(fd);
+    if (data == MAP_FAILED)
+        throw exception("Cannot map " + path + " (" + std::string(std::strerror(error)) + ")");
+
+    // requestors read data from start to end chunk by chunk
+    madvise(data, size, MADV_SEQUENTIAL);
+    return buffer(static_cast<const char*>(data), size,
+                  [size](const char* mapping) { munmap(const_cast<char*>(mapping), size); });
+}
+
+} // namespace clipboardxx
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace clipboardxx {
+
+// selection ownership claims of every clipboard in this process, pastes wait for the ones still on their way
+class OwnershipClaims {
+public:
+    OwnershipClaims() = default;
+
+    static OwnershipClaims &instance() {
+        static OwnershipClaims claims;
+        return claims;
+    }
+
+    // number of the new claim, every claim must be ended once it is confirmed or failed
+    uint64_t begin() {
+        std::lock_guard<std::mutex> lock_guard(m_lock);
+        m_pending++;
+        return ++m_last;
+    }
+
+    // claim of a selection that is already owned, it keeps the number of the last claim but pastes still wait for it
+    void begin_renewal() {
+        std::lock_guard<std::mutex> lock_guard(m_lock);
+        m_pending++;
+    }
+
+    void end() {
+        {
+            std::lock_guard<std::mutex> lock_guard(m_lock);
+            m_pending--;
+        }
+        m_ended.notify_all();
+    }
+
+    uint64_t get_last() {
+        std::lock_guard<std::mutex> lock_guard(m_lock);
+        return m_last;
+    }
+
+    void wait_for_pending(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_ended.wait_for(lock, timeout, [this] { return m_pending == 0; });
+    }
+
+private:
+    std::mutex m_lock;
+    std::condition_variable m_ended;
+    uint64_t m_last = 0;
+    size_t m_pending = 0;
+};
+
+} // namespace clipboardxx
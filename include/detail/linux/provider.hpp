@@ -1,14 +1,37 @@
 #pragma once
 
+#include "../async.hpp"
+#include "../buffer.hpp"
+#include "../stats.hpp"
+
+#include <chrono>
+#include <cstddef>
 #include <string>
+#include <vector>
 
 namespace clipboardxx {
 
 class LinuxClipboardProvider {
 public:
-    virtual void copy(const std::string &text) = 0;
-    virtual std::string paste() = 0;
+    virtual void warm_up() = 0;
+    virtual void copy(buffer data) = 0;
+    virtual void copy(std::vector<mime_data> formats) = 0;
+    virtual buffer paste() = 0;
+    virtual buffer paste(const std::string &mime_type) = 0;
+    virtual std::vector<buffer> paste(const std::vector<std::string> &mime_types) = 0;
+    virtual size_t paste(const paste_sink &sink, const std::string &mime_type) = 0;
+    virtual bool on_change(change_callback callback, cancellation cancel) = 0;
+    virtual stats get_stats() = 0;
     virtual ~LinuxClipboardProvider() = default;
 };
 
+// providers without it get the synchronous defaults of ClipboardInterface
+class LinuxAsyncClipboardProvider : public LinuxClipboardProvider {
+public:
+    using LinuxClipboardProvider::copy;
+    virtual void copy(std::vector<lazy_mime_data> formats) = 0;
+    virtual void copy_async(buffer data, copy_callback callback) = 0;
+    virtual void paste_async(paste_callback callback, std::chrono::milliseconds timeout, cancellation cancel) = 0;
+};
+
 } // namespace clipboardxx
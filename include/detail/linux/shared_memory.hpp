@@ -0,0 +1,159 @@
+#pragma once
+
+#include "../exception.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace clipboardxx {
+
+// POSIX shared memory object mapped into this process, it outlives every process until it gets unlinked
+class SharedMemory {
+public:
+    // growing only appends zeroes, so processes opening it at the same time see the same content
+    static std::unique_ptr<SharedMemory> open_or_create(const std::string &name, size_t size) {
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (fd < 0)
+            throw_error("Cannot open shared memory " + name);
+
+        size_t current_size = get_size(fd, name);
+        if (current_size < size && ftruncate(fd, static_cast<off_t>(size)) != 0)
+            throw_error("Cannot resize shared memory " + name, fd);
+        return map(fd, name, std::max(current_size, size), PROT_READ | PROT_WRITE);
+    }
+
+    // the object stays locked until `release_lock`, so `unlink_abandoned` leaves it alone while we live
+    static std::unique_ptr<SharedMemory> create(const std::string &name, size_t size) {
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (fd < 0 && errno == EEXIST)
+            return nullptr;
+        if (fd < 0)
+            throw_error("Cannot create shared memory " + name);
+
+        if (flock(fd, LOCK_EX) != 0)
+            throw_error("Cannot lock shared memory " + name, fd);
+        // mapping closes `fd`, the lock lives on in its duplicate
+        int lock_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (lock_fd < 0)
+            throw_error("Cannot lock shared memory " + name, fd);
+        if (!is_linked(fd, name)) {
+            close(lock_fd);
+            close(fd);
+            return nullptr;
+        }
+
+        int error = posix_fallocate(fd, 0, static_cast<off_t>(size));
+        if (error != 0) {
+            close(lock_fd);
+            close(fd);
+            shm_unlink(name.c_str());
+            throw exception("Cannot allocate shared memory " + name + " (" + std::string(std::strerror(error)) + ")");
+        }
+        std::unique_ptr<SharedMemory> memory = map(fd, name, size, PROT_READ | PROT_WRITE);
+        memory->m_lock_fd = lock_fd;
+        return memory;
+    }
+
+    // nothing is returned when the object doesn't exist (anymore)
+    static std::unique_ptr<SharedMemory> open_read_only(const std::string &name) {
+        int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (fd < 0 && errno == ENOENT)
+            return nullptr;
+        if (fd < 0)
+            throw_error("Cannot open shared memory " + name);
+        return map(fd, name, get_size(fd, name), PROT_READ);
+    }
+
+    // mappings of the object stay valid, it is only freed once the last of them is gone
+    static void unlink(const std::string &name) { shm_unlink(name.c_str()); }
+
+    // unlinks an object whose creator died before releasing its lock, unless `is_published` says somebody uses it
+    static void unlink_abandoned(const std::string &name, const std::function<bool()> &is_published) {
+        int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (fd < 0)
+            return;
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0 && !is_published())
+            shm_unlink(name.c_str());
+        close(fd);
+    }
+
+    void release_lock() {
+        if (m_lock_fd >= 0)
+            close(m_lock_fd);
+        m_lock_fd = -1;
+    }
+
+    SharedMemory(const SharedMemory &) = delete;
+    SharedMemory &operator=(const SharedMemory &) = delete;
+
+    ~SharedMemory() {
+        release_lock();
+        if (m_size != 0)
+            munmap(m_data, m_size);
+    }
+
+    char* data() const { return static_cast<char*>(m_data); }
+
+    size_t size() const { return m_size; }
+
+private:
+    SharedMemory(void* data, size_t size) : m_data(data), m_size(size) {}
+
+    static size_t get_size(int fd, const std::string &name) {
+        struct stat memory_stat {};
+        if (fstat(fd, &memory_stat) != 0)
+            throw_error("Cannot get size of shared memory " + name, fd);
+        return static_cast<size_t>(memory_stat.st_size);
+    }
+
+    // object got unlinked when the name leads to another one or to nothing
+    static bool is_linked(int fd, const std::string &name) {
+        int linked_fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (linked_fd < 0)
+            return false;
+        struct stat memory_stat {};
+        struct stat linked_stat {};
+        bool linked = fstat(fd, &memory_stat) == 0 && fstat(linked_fd, &linked_stat) == 0 &&
+                      memory_stat.st_dev == linked_stat.st_dev && memory_stat.st_ino == linked_stat.st_ino;
+        close(linked_fd);
+        return linked;
+    }
+
+    // takes over `fd`, mapping keeps the object open by itself
+    static std::unique_ptr<SharedMemory> map(int fd, const std::string &name, size_t size, int protection) {
+        if (size == 0) {
+            close(fd);
+            return std::unique_ptr<SharedMemory>(new SharedMemory(nullptr, 0));
+        }
+
+        void* data = mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+            throw_error("Cannot map shared memory " + name, fd);
+        close(fd);
+        return std::unique_ptr<SharedMemory>(new SharedMemory(data, size));
+    }
+
+    [[noreturn]] static void throw_error(const std::string &reason, std::optional<int> fd_to_close = std::nullopt) {
+        int error = errno;
+        if (fd_to_close.has_value())
+            close(fd_to_close.value());
+        throw exception(reason + " (" + std::string(std::strerror(error)) + ")");
+    }
+
+    void* const m_data;
+    const size_t m_size;
+    int m_lock_fd = -1;
+};
+
+} // namespace clipboardxx
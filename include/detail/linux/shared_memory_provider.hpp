@@ -0,0 +1,384 @@
+#pragma once
+
+#include "../async.hpp"
+#include "../buffer.hpp"
+#include "../exception.hpp"
+#include "../options.hpp"
+#include "../stats.hpp"
+#include "provider.hpp"
+#include "shared_memory.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <linux/futex.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace clipboardxx {
+
+// layout of shared memory objects changes together with this version
+constexpr const char* kSharedMemoryNamePrefix = "/clipboardxx-v1-";
+// text copied under any of these is pasted under all of them, like X11 offers text under every text target
+constexpr std::array<const char*, 6> kSharedTextMimeTypes = {
+    "text/plain;charset=utf-8", "text/plain;charset=UTF-8", "text/plain", "UTF8_STRING", "TEXT", "STRING"};
+// data of each format starts at a cache line
+constexpr size_t kSharedDataAlignment = 64;
+
+// state of one selection that all processes of the user map, zero filled memory is a valid empty state
+struct SharedClipboardState {
+    std::atomic<uint32_t> changes;         // futex word, bumped after every copy
+    std::atomic<uint64_t> generation;      // data object of the latest copy, zero until somebody copies
+    std::atomic<uint64_t> last_generation; // taken by each copy for the name of its data object
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "atomics in shared memory must be lock free to work across processes");
+
+// data object of a copy starts with this header, it is never written again once published
+struct SharedDataHeader {
+    uint32_t owner;     // pid of the copying process
+    uint32_t timestamp; // milliseconds of wall clock time when it copied, wraps around like X server time
+    uint64_t format_count;
+};
+
+struct SharedFormat {
+    uint64_t mime_type_offset;
+    uint64_t mime_type_size;
+    uint64_t data_offset;
+    uint64_t data_size;
+};
+
+// clipboard for hosts without X server, pastes return buffers pointing into the shared memory object of the copy
+class SharedMemoryProvider : public LinuxClipboardProvider {
+public:
+    explicit SharedMemoryProvider(const options &opts) : m_name(get_state_name(opts.selection)) {}
+
+    ~SharedMemoryProvider() override { stop_watching_changes(); }
+
+    void warm_up() override { get_state(); }
+
+    void copy(buffer data) override {
+        copy(std::vector<mime_data>{mime_data{kSharedTextMimeTypes[0], std::move(data)}});
+    }
+
+    void copy(std::vector<mime_data> formats) override {
+        SharedClipboardState &state = get_state();
+
+        std::vector<SharedFormat> table(formats.size());
+        uint64_t size = sizeof(SharedDataHeader) + table.size() * sizeof(SharedFormat);
+        for (size_t i = 0; i < formats.size(); i++) {
+            table[i].mime_type_offset = size;
+            table[i].mime_type_size = formats[i].mime_type.size();
+            size += formats[i].mime_type.size();
+        }
+        for (size_t i = 0; i < formats.size(); i++) {
+            size = (size + kSharedDataAlignment - 1) / kSharedDataAlignment * kSharedDataAlignment;
+            table[i].data_offset = size;
+            table[i].data_size = formats[i].data.size();
+            size += formats[i].data.size();
+        }
+
+        // a leftover object of a process that died while copying just gets skipped here
+        uint64_t generation = 0;
+        std::shared_ptr<SharedMemory> data;
+        while (!data) {
+            generation = state.last_generation.fetch_add(1, std::memory_order_relaxed) + 1;
+            data = SharedMemory::create(get_data_name(generation), size);
+        }
+
+        const SharedDataHeader header{static_cast<uint32_t>(getpid()), get_timestamp(), formats.size()};
+        std::memcpy(data->data(), &header, sizeof(header));
+        std::memcpy(data->data() + sizeof(header), table.data(), table.size() * sizeof(SharedFormat));
+        for (size_t i = 0; i < formats.size(); i++) {
+            std::memcpy(data->data() + table[i].mime_type_offset, formats[i].mime_type.data(),
+                        formats[i].mime_type.size());
+            if (!formats[i].data.empty())
+                std::memcpy(data->data() + table[i].data_offset, formats[i].data.data(), formats[i].data.size());
+        }
+        set_current_data(generation, data);
+
+        // whoever replaces an object unlinks it, processes that still have it mapped keep their data
+        uint64_t replaced = state.generation.exchange(generation, std::memory_order_acq_rel);
+        data->release_lock();
+        if (replaced != 0)
+            SharedMemory::unlink(get_data_name(replaced));
+        // objects between the two were never published, those whose creator died are unlinked
+        for (uint64_t skipped = replaced + 1; skipped < generation; skipped++) {
+            SharedMemory::unlink_abandoned(get_data_name(skipped), [&state, skipped] {
+                return state.generation.load(std::memory_order_acquire) == skipped;
+            });
+        }
+        state.changes.fetch_add(1, std::memory_order_release);
+        wake_futex(state.changes);
+        m_copies.add();
+    }
+
+    buffer paste() override { return paste(std::string()); }
+
+    // empty mime type means text
+    buffer paste(const std::string &mime_type) override {
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        buffer result = find_format(get_current_data(), mime_type);
+        record_paste(started, result.size());
+        return result;
+    }
+
+    // all formats come from the same copy
+    std::vector<buffer> paste(const std::vector<std::string> &mime_types) override {
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        std::shared_ptr<const SharedMemory> data = get_current_data();
+        std::vector<buffer> result;
+        size_t size = 0;
+        for (const std::string &mime_type : mime_types) {
+            result.push_back(find_format(data, mime_type));
+            size += result.back().size();
+        }
+        record_paste(started, size);
+        return result;
+    }
+
+    // data is already complete in memory, so sink gets it at once
+    size_t paste(const paste_sink &sink, const std::string &mime_type) override {
+        const buffer data = paste(mime_type);
+        if (!data.empty())
+            sink(data.data(), data.size());
+        return data.size();
+    }
+
+    // a thread waits on the futex word of the selection once somebody wants to know about changes
+    bool on_change(change_callback callback, cancellation cancel) override {
+        SharedClipboardState &state = get_state();
+        std::lock_guard<std::mutex> lock_guard(m_listeners_lock);
+        m_listeners.push_back(Listener{std::move(callback), std::move(cancel)});
+        // copies right after this call are reported as well, even when the thread isn't running yet
+        if (!m_watcher.joinable()) {
+            uint64_t generation = state.generation.load(std::memory_order_acquire);
+            m_watcher = std::thread([this, &state, generation] { watch_changes(state, generation); });
+        }
+        return true;
+    }
+
+    stats get_stats() override {
+        stats result;
+        result.copies = m_copies.get();
+        result.pastes = m_pastes.get();
+        result.bytes_pasted = m_bytes_pasted.get();
+        result.paste_latency = m_paste_latency.snapshot();
+        return result;
+    }
+
+private:
+    struct Listener {
+        change_callback callback;
+        cancellation cancel;
+    };
+
+    static std::string get_state_name(selection which) {
+        std::string name = kSharedMemoryNamePrefix + std::to_string(getuid()) + "-";
+        switch (which) {
+        case selection::primary:
+            return name + "primary";
+        case selection::secondary:
+            return name + "secondary";
+        case selection::clipboard:
+        default:
+            return name + "clipboard";
+        }
+    }
+
+    std::string get_data_name(uint64_t generation) const { return m_name + "-" + std::to_string(generation); }
+
+    static uint32_t get_timestamp() {
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                         std::chrono::system_clock::now().time_since_epoch())
+                                         .count());
+    }
+
+    // mapped by the first operation, failing to map it is retried by the next one
+    SharedClipboardState &get_state() {
+        SharedClipboardState* state = m_ready_state.load(std::memory_order_acquire);
+        if (state)
+            return *state;
+
+        std::lock_guard<std::mutex> lock_guard(m_init_lock);
+        if (!m_state_memory) {
+            m_state_memory = SharedMemory::open_or_create(m_name, sizeof(SharedClipboardState));
+            m_ready_state.store(reinterpret_cast<SharedClipboardState*>(m_state_memory->data()),
+                                std::memory_order_release);
+        }
+        return *reinterpret_cast<SharedClipboardState*>(m_state_memory->data());
+    }
+
+    // kept mapped so pasting the same copy again needs no syscall
+    std::shared_ptr<const SharedMemory> get_current_data() {
+        SharedClipboardState &state = get_state();
+        while (true) {
+            uint64_t generation = state.generation.load(std::memory_order_acquire);
+            if (generation == 0)
+                return nullptr;
+
+            {
+                std::lock_guard<std::mutex> lock_guard(m_data_lock);
+                if (m_data && m_data_generation == generation)
+                    return m_data;
+            }
+
+            // object is gone when a newer copy replaced it meanwhile, that one is taken instead
+            std::shared_ptr<const SharedMemory> data = SharedMemory::open_read_only(get_data_name(generation));
+            if (!data)
+                continue;
+            validate_data(*data);
+            set_current_data(generation, data);
+            return data;
+        }
+    }
+
+    void set_current_data(uint64_t generation, std::shared_ptr<const SharedMemory> data) {
+        std::lock_guard<std::mutex> lock_guard(m_data_lock);
+        m_data = std::move(data);
+        m_data_generation = generation;
+    }
+
+    // objects are written by processes of the same user only, this just keeps a broken one from crashing us
+    void validate_data(const SharedMemory &data) const {
+        const auto fits = [&data](uint64_t offset, uint64_t size) {
+            return offset <= data.size() && size <= data.size() - offset;
+        };
+
+        bool valid = fits(0, sizeof(SharedDataHeader));
+        if (valid) {
+            const SharedDataHeader* header = reinterpret_cast<const SharedDataHeader*>(data.data());
+            valid = header->format_count <= data.size() / sizeof(SharedFormat) &&
+                    fits(sizeof(SharedDataHeader), header->format_count * sizeof(SharedFormat));
+            const SharedFormat* table = reinterpret_cast<const SharedFormat*>(data.data() + sizeof(SharedDataHeader));
+            for (uint64_t i = 0; valid && i < header->format_count; i++)
+                valid = fits(table[i].mime_type_offset, table[i].mime_type_size) &&
+                        fits(table[i].data_offset, table[i].data_size);
+        }
+        if (!valid)
+            throw exception("Shared memory of " + m_name + " is corrupted");
+    }
+
+    static bool is_text_mime_type(std::string_view mime_type) {
+        return std::find(kSharedTextMimeTypes.begin(), kSharedTextMimeTypes.end(), mime_type) !=
+               kSharedTextMimeTypes.end();
+    }
+
+    // buffer shares the mapping, so it stays valid after the data gets replaced
+    static buffer find_format(const std::shared_ptr<const SharedMemory> &data, const std::string &mime_type) {
+        if (!data)
+            return buffer();
+
+        bool want_text = mime_type.empty() || is_text_mime_type(mime_type);
+        const SharedDataHeader* header = reinterpret_cast<const SharedDataHeader*>(data->data());
+        const SharedFormat* table = reinterpret_cast<const SharedFormat*>(data->data() + sizeof(SharedDataHeader));
+        for (uint64_t i = 0; i < header->format_count; i++) {
+            std::string_view name(data->data() + table[i].mime_type_offset, table[i].mime_type_size);
+            if (name != mime_type && !(want_text && is_text_mime_type(name)))
+                continue;
+            if (table[i].data_size == 0)
+                return buffer();
+            return buffer(data->data() + table[i].data_offset, table[i].data_size,
+                          [data](const char* /*data*/) {});
+        }
+        return buffer();
+    }
+
+    void record_paste(std::chrono::steady_clock::time_point started, size_t size) {
+        m_pastes.add();
+        m_bytes_pasted.add(size);
+        m_paste_latency.record(std::chrono::steady_clock::now() - started);
+    }
+
+    // futex word lives in memory shared between processes, so the private futex operations can't be used
+    static void wait_for_futex(const std::atomic<uint32_t> &word, uint32_t value) {
+        syscall(SYS_futex, reinterpret_cast<const uint32_t*>(&word), FUTEX_WAIT, value, nullptr, nullptr, 0);
+    }
+
+    static void wake_futex(const std::atomic<uint32_t> &word) {
+        syscall(SYS_futex, reinterpret_cast<const uint32_t*>(&word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+    }
+
+    // futex word is read first, so a change right after it can't get missed
+    void watch_changes(SharedClipboardState &state, uint64_t seen_generation) noexcept {
+        while (true) {
+            uint32_t changes = state.changes.load(std::memory_order_acquire);
+            if (m_stop_watching)
+                return;
+
+            uint64_t generation = state.generation.load(std::memory_order_acquire);
+            if (generation != seen_generation) {
+                seen_generation = generation;
+                notify_listeners();
+            }
+            wait_for_futex(state.changes, changes);
+        }
+    }
+
+    void notify_listeners() noexcept {
+        change_event change{0, 0};
+        try {
+            std::shared_ptr<const SharedMemory> data = get_current_data();
+            if (data) {
+                const SharedDataHeader* header = reinterpret_cast<const SharedDataHeader*>(data->data());
+                change = change_event{header->owner, header->timestamp};
+            }
+        } catch (const exception &) {
+            return;
+        }
+
+        std::vector<Listener> listeners;
+        {
+            std::lock_guard<std::mutex> lock_guard(m_listeners_lock);
+            m_listeners.erase(std::remove_if(m_listeners.begin(), m_listeners.end(),
+                                             [](const Listener &listener) { return listener.cancel.is_cancelled(); }),
+                              m_listeners.end());
+            listeners = m_listeners;
+        }
+        for (const Listener &listener : listeners)
+            if (!listener.cancel.is_cancelled())
+                listener.callback(change);
+    }
+
+    // bumping the futex word wakes watchers of other processes as well, they see no new data and keep waiting
+    void stop_watching_changes() {
+        if (!m_watcher.joinable())
+            return;
+
+        SharedClipboardState &state = get_state();
+        m_stop_watching = true;
+        state.changes.fetch_add(1, std::memory_order_release);
+        wake_futex(state.changes);
+        m_watcher.join();
+    }
+
+    const std::string m_name;
+    std::mutex m_init_lock;
+    std::unique_ptr<SharedMemory> m_state_memory; // guarded by `m_init_lock`
+    std::atomic<SharedClipboardState*> m_ready_state = nullptr;
+
+    std::mutex m_data_lock;
+    std::shared_ptr<const SharedMemory> m_data; // guarded by `m_data_lock`
+    uint64_t m_data_generation = 0;
+
+    std::mutex m_listeners_lock;
+    std::vector<Listener> m_listeners; // guarded by `m_listeners_lock`
+    std::thread m_watcher;
+    std::atomic<bool> m_stop_watching = false;
+
+    Counter m_copies;
+    Counter m_pastes;
+    Counter m_bytes_pasted;
+    LatencyRecorder m_paste_latency;
+};
+
+} // namespace clipboardxx
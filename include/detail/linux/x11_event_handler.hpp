@@ -1,165 +1,1633 @@
 #pragma once
 
+#include "../async.hpp"
+#include "../buffer.hpp"
+#include "../exception.hpp"
+#include "../options.hpp"
+#include "../stats.hpp"
+#include "../text_encoding.hpp"
+#include "detached_process.hpp"
+#include "ownership_claims.hpp"
+#include "x11_selection_data.hpp"
 #include "xcb/xcb.hpp"
 
 #include <algorithm>
 #include <array>
 #include <atomic>
 #include <chrono>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iterator>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <variant>
 #include <vector>
 
 namespace clipboardxx {
 
-constexpr std::chrono::duration kHandleEventsForEverDelay = std::chrono::milliseconds(20);
-constexpr std::chrono::duration kWaitForPasteDataTimeout = std::chrono::milliseconds(300);
+constexpr const char* kClipboardAtomName = "CLIPBOARD";
+constexpr std::chrono::duration kIncrTransferTimeout = std::chrono::seconds(5);
 constexpr std::array<const char*, 7> kSupportedTextFormats = {
     "UTF8_STRING", "text/plain;charset=utf-8", "text/plain;charset=UTF-8", "GTK_TEXT_BUFFER_CONTENTS", "STRING", "TEXT",
     "text/plain"};
+// every paste in flight needs its own property on our window to receive data
+constexpr size_t kMaxPastesInFlight = 4;
+constexpr const char* kPastePropertyAtomNamePrefix = "CLIPBOARDXX_BUFFER_";
+// owners change whenever someone copies, so the cache of their targets is simply dropped when it grows this much
+constexpr size_t kMaxCachedOwnerTargets = 16;
+constexpr std::chrono::milliseconds kClipboardManagerTimeout = std::chrono::milliseconds(500);
+constexpr std::chrono::milliseconds kWaitForOwnershipClaimsTimeout = std::chrono::milliseconds(300);
+constexpr const char* kTimestampAtomName = "CLIPBOARDXX_TIMESTAMP";
 
 struct EssentialAtoms {
-    std::vector<xcb::Atom> supported_text_formats;
-    xcb::Atom clipboard, targets, atom, buffer;
+    std::vector<xcb::Atom> supported_text_formats, paste_properties;
+    xcb::Atom clipboard, targets, atom, incr, multiple, atom_pair, clipboard_manager, save_targets, timestamp;
+    xcb::Atom utf8_string, text; // also among `supported_text_formats`
+    xcb::Atom primary = XCB_ATOM_PRIMARY, secondary = XCB_ATOM_SECONDARY;
+};
+
+// one format of a paste that asks for several of them at once
+struct PastePart {
+    std::vector<xcb::Atom> formats; // acceptable targets, most preferred first
+    xcb::Atom property = XCB_ATOM_NONE; // none once there is nothing more to receive with MULTIPLE target
+    std::optional<std::string> incr_data;
+    xcb::Atom data_type = XCB_ATOM_NONE; // type of the incremental chunks
+    buffer data;
+};
+
+using PastePartsCallback = std::function<void(std::exception_ptr error, std::vector<buffer> data)>;
+
+// a paste waiting to be sent to selection owner or for its answer
+struct PasteRequest {
+    enum Stage { kQueued, kCached, kTargets, kData, kMultiple };
+
+    paste_callback callback;
+    cancellation cancel;
+    std::chrono::milliseconds timeout;
+    std::chrono::steady_clock::time_point deadline;
+    std::chrono::steady_clock::time_point started;
+    xcb::Atom selection;
+    std::vector<xcb::Atom> formats; // acceptable targets, most preferred first
+    xcb::Atom property; // none until selection conversion gets requested
+    std::optional<std::string> incr_data;
+    Stage stage = kQueued;
+    xcb::Window owner = XCB_WINDOW_NONE;
+    bool targets_from_cache = false;
+    uint64_t owner_change = 0; // count of owner changes when the owner was asked
+    // pastes of several formats are answered through `parts_callback` instead of `callback`
+    std::vector<PastePart> parts = {};
+    PastePartsCallback parts_callback = nullptr;
+    std::vector<xcb::Atom> targets = {}; // offered by owner, parts pick their format from them
+    size_t next_part = 0;
+    // streaming pastes hand every piece to `sink` as it arrives, so nothing gets cached
+    paste_sink sink = nullptr;
+    size_t streamed = 0;
+    xcb::Atom data_type = XCB_ATOM_NONE; // type of the incremental chunks
+    uint64_t cancel_registration = 0; // listener that wakes up event thread, removed once the request is finished
+    xcb::Atom target = XCB_ATOM_NONE; // of the conversion waited for, refusals only tell this apart
+};
+
+// data pasted from one owner, dropped as soon as XFixes reports any change of ownership
+struct PasteCache {
+    xcb::Window owner = XCB_WINDOW_NONE;
+    uint64_t owner_change = 0;
+    std::unordered_map<xcb::Atom, buffer> data; // keyed by most preferred format of the paste
+};
+
+// everything that is kept separately for each selection, only `data` and the claim are used outside of event thread
+struct SelectionState {
+    SelectionDataSlot data; // null while we are not the owner
+    std::atomic<bool> owned = false; // confirmed by event thread, until somebody else takes the selection
+    std::atomic<uint64_t> claim = 0; // number of our latest ownership claim
+    std::atomic<xcb_timestamp_t> claim_time = XCB_CURRENT_TIME;
+    std::atomic<uint64_t> renewal = 0; // number of our latest renewal
+    uint64_t finished_renewal = 0;      // only used by event thread
+    std::exception_ptr copy_error; // failure of a copy that had no callback to report it, guarded by `m_lock`
+    std::unordered_map<xcb::Window, std::vector<xcb::Atom>> owner_targets;
+    PasteCache paste_cache;
+    uint64_t owner_changes = 0;
+};
+
+struct ChangeListener {
+    xcb::Atom selection;
+    change_callback callback;
+    cancellation cancel;
+};
+
+// ownership claim waiting to be confirmed, a claim ignored for its stale timestamp is made once more
+struct CopyRequest {
+    enum Stage { kClaimed, kWaitingForTimestamp, kReclaimed, kRenewed, kContested };
+
+    xcb::Atom selection;
+    std::shared_ptr<const SelectionData> data;
+    copy_callback callback; // null for synchronous copies, their failure is reported by the next copy
+    uint64_t claim;
+    Stage stage = kClaimed;
+    uint64_t timestamp_request = 0; // number of the timestamp request whose property change the request waits for
+    uint64_t renewal = 0;
+};
+
+// selection data that is being sent to a requestor chunk by chunk
+struct IncrTransfer {
+    xcb::Window requestor;
+    xcb::Atom property, type;
+    buffer data;
+    size_t offset;
+    std::chrono::steady_clock::time_point last_activity;
+};
+
+// everything in `stats` except round trips which are counted by xcb wrapper
+struct EventHandlerStats {
+    Counter copies, pastes, self_pastes, paste_cache_hits, paste_timeouts, paste_cancellations;
+    Counter bytes_pasted, bytes_served, requests_served, requests_refused;
+    LatencyRecorder paste_latency, request_latency;
 };
 
 class X11EventHandler {
 public:
-    X11EventHandler(std::shared_ptr<xcb::Xcb> xcb)
-        : m_xcb(std::move(xcb)), m_atoms(create_essential_atoms()),
-          m_targets(generate_targets_atom_array(m_atoms.targets, m_atoms.supported_text_formats)),
-          m_stop_event_thread(false) {
+    X11EventHandler(const std::shared_ptr<xcb::Xcb> &xcb, const options &opts)
+        : X11EventHandler(xcb, opts, create_essential_atoms(*xcb), OwnershipClaims::instance()) {
         m_event_thread = std::thread(&X11EventHandler::handle_events_for_ever, this);
     }
 
     ~X11EventHandler() {
         m_stop_event_thread = true;
-        m_event_thread.join();
+        m_xcb->wake_up();
+        if (m_event_thread.joinable())
+            m_event_thread.join();
+
+        if (m_persist)
+            persist_selections();
+        take_new_requests();
+        for (PasteRequest &request : m_paste_requests)
+            finish_paste_request(request, std::make_exception_ptr(cancelled_exception()), buffer());
+        for (CopyRequest &request : m_copy_requests)
+            finish_copy_request(request, std::make_exception_ptr(cancelled_exception()));
+        run_completions(std::move(m_completions));
     }
 
-    void set_copy_data(const std::string &data) {
-        std::lock_guard<std::mutex> lock_guard(m_lock);
-        m_copy_data = std::optional<std::string>(data);
+    // each selection has its own data, owning one of them doesn't affect the others
+
+    void set_copy_data(selection which, buffer text) {
+        set_selection_data(get_selection_atom(which), create_text_selection_data(std::move(text)));
+    }
+
+    void set_copy_data(selection which, std::vector<mime_data> formats) {
+        std::vector<std::pair<std::string, Offer>> offers;
+        for (mime_data &format : formats)
+            offers.emplace_back(std::move(format.mime_type), Offer(std::move(format.data)));
+        set_selection_data(get_selection_atom(which), create_selection_data(std::move(offers)));
+    }
+
+    void set_copy_data(selection which, std::vector<lazy_mime_data> formats) {
+        std::vector<std::pair<std::string, Offer>> offers;
+        for (lazy_mime_data &format : formats)
+            offers.emplace_back(std::move(format.mime_type), Offer(std::move(format.producer), format.memoize));
+        set_selection_data(get_selection_atom(which), create_selection_data(std::move(offers)));
+    }
+
+    // callback gets called once we own the selection, right away when we already do
+    void set_copy_data_async(selection which, buffer text, copy_callback callback) {
+        claim_selection(get_selection_atom(which), create_text_selection_data(std::move(text)), std::move(callback));
+    }
+
+    // empty data is returned when owner doesn't answer in time, empty `mime_type` means text
+    buffer get_paste_data(selection which, const std::string &mime_type = std::string()) {
+        // event thread would wait for itself
+        if (std::this_thread::get_id() == m_event_thread.get_id())
+            throw exception("Cannot wait for paste data inside a clipboard callback");
+
+        wait_for_ownership_claims(get_selection_atom(which));
+        std::shared_ptr<std::promise<buffer>> promise = std::make_shared<std::promise<buffer>>();
+        std::future<buffer> result = promise->get_future();
+        get_paste_data_async(
+            which, mime_type,
+            [promise](std::exception_ptr error, buffer data) {
+                if (error)
+                    promise->set_exception(error);
+                else
+                    promise->set_value(std::move(data));
+            },
+            kWaitForPasteDataTimeout, cancellation());
+
+        try {
+            return result.get();
+        } catch (const timeout_exception &) {
+            return buffer();
+        }
+    }
+
+    // pasting our own data passes the copied buffer itself right away
+    void get_paste_data_async(selection which, const std::string &mime_type, paste_callback callback,
+                              std::chrono::milliseconds timeout, cancellation cancel) {
+        if (cancel.is_cancelled()) {
+            callback(std::make_exception_ptr(cancelled_exception()), buffer());
+            return;
+        }
+
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        m_stats.pastes.add();
+        xcb::Atom selection_atom = get_selection_atom(which);
+        std::vector<xcb::Atom> formats = get_acceptable_formats(mime_type);
+        if (std::shared_ptr<const SelectionData> data = m_selections.at(selection_atom).data.load()) {
+            complete_self_paste(data->get_first_of(formats), callback, started);
+            return;
+        }
+
+        std::weak_ptr<xcb::Xcb> weak_xcb = m_xcb;
+        uint64_t cancel_registration = cancel.on_cancel([weak_xcb] {
+            if (std::shared_ptr<xcb::Xcb> xcb = weak_xcb.lock())
+                xcb->wake_up();
+        });
+
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+        PasteRequest request{std::move(callback), std::move(cancel), timeout, deadline, started, selection_atom,
+                             std::move(formats), XCB_ATOM_NONE, std::nullopt};
+        request.cancel_registration = cancel_registration;
+        {
+            std::lock_guard<std::mutex> lock_guard(m_lock);
+            m_new_paste_requests.push_back(std::move(request));
+        }
+        m_xcb->wake_up();
     }
 
-    std::string get_paste_data() {
+    // memory use doesn't grow with size of data, an owner that stops sending halfway throws `timeout_exception`
+    size_t get_paste_data(selection which, const std::string &mime_type, const paste_sink &sink) {
+        if (std::this_thread::get_id() == m_event_thread.get_id())
+            throw exception("Cannot wait for paste data inside a clipboard callback");
+
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        m_stats.pastes.add();
+        xcb::Atom selection_atom = get_selection_atom(which);
+        wait_for_ownership_claims(selection_atom);
+        std::vector<xcb::Atom> formats = get_acceptable_formats(mime_type);
+        if (std::shared_ptr<const SelectionData> data = m_selections.at(selection_atom).data.load()) {
+            std::optional<Offer> offer = data->get_first_of(formats);
+            const buffer pasted = offer.has_value() ? offer->get() : buffer();
+            m_stats.self_pastes.add();
+            m_stats.paste_latency.record(std::chrono::steady_clock::now() - started);
+            if (!pasted.empty())
+                sink(pasted.data(), pasted.size());
+            return pasted.size();
+        }
+
+        // request is finished before the promise gets its value, so `sink` and `written` outlive every use of them
+        size_t written = 0;
+        std::shared_ptr<std::promise<void>> promise = std::make_shared<std::promise<void>>();
+        std::future<void> result = promise->get_future();
+        PasteRequest request{[promise](std::exception_ptr error, buffer) {
+                                 if (error)
+                                     promise->set_exception(error);
+                                 else
+                                     promise->set_value();
+                             },
+                             cancellation(),
+                             kWaitForPasteDataTimeout,
+                             started + kWaitForPasteDataTimeout,
+                             started,
+                             selection_atom,
+                             std::move(formats),
+                             XCB_ATOM_NONE,
+                             std::nullopt};
+        request.sink = [&sink, &written](const char* data, size_t size) {
+            sink(data, size);
+            written += size;
+        };
         {
             std::lock_guard<std::mutex> lock_guard(m_lock);
-            if (do_we_own_clipoard())
-                return m_copy_data.value();
+            m_new_paste_requests.push_back(std::move(request));
+        }
+        m_xcb->wake_up();
+
+        try {
+            result.get();
+        } catch (const timeout_exception &) {
+            // like other pastes, an owner that never answers just means there is nothing to paste
+            if (written != 0)
+                throw;
+        }
+        return written;
+    }
+
+    // all formats are asked with one MULTIPLE request
+    std::vector<buffer> get_paste_data(selection which, const std::vector<std::string> &mime_types) {
+        if (std::this_thread::get_id() == m_event_thread.get_id())
+            throw exception("Cannot wait for paste data inside a clipboard callback");
+        if (mime_types.empty())
+            return {};
+
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        m_stats.pastes.add();
+        xcb::Atom selection_atom = get_selection_atom(which);
+        wait_for_ownership_claims(selection_atom);
+        std::vector<PastePart> parts;
+        for (const std::string &mime_type : mime_types) {
+            PastePart part;
+            part.formats = get_acceptable_formats(mime_type);
+            parts.push_back(std::move(part));
+        }
+
+        if (std::shared_ptr<const SelectionData> data = m_selections.at(selection_atom).data.load()) {
+            std::vector<buffer> result;
+            for (const PastePart &part : parts) {
+                std::optional<Offer> offer = data->get_first_of(part.formats);
+                result.push_back(offer.has_value() ? offer->get() : buffer());
+            }
+            m_stats.self_pastes.add();
+            m_stats.paste_latency.record(std::chrono::steady_clock::now() - started);
+            return result;
+        }
+
+        std::shared_ptr<std::promise<std::vector<buffer>>> promise =
+            std::make_shared<std::promise<std::vector<buffer>>>();
+        std::future<std::vector<buffer>> result = promise->get_future();
+        PasteRequest request{paste_callback(), cancellation(), kWaitForPasteDataTimeout,
+                             started + kWaitForPasteDataTimeout, started, selection_atom, {}, XCB_ATOM_NONE,
+                             std::nullopt};
+        request.parts = std::move(parts);
+        request.parts_callback = [promise](std::exception_ptr error, std::vector<buffer> data) {
+            if (error)
+                promise->set_exception(error);
             else
-                m_xcb->request_selection_data(m_atoms.clipboard, m_atoms.supported_text_formats.at(0), m_atoms.buffer);
+                promise->set_value(std::move(data));
+        };
+        {
+            std::lock_guard<std::mutex> lock_guard(m_lock);
+            m_new_paste_requests.push_back(std::move(request));
         }
+        m_xcb->wake_up();
+
+        try {
+            return result.get();
+        } catch (const timeout_exception &) {
+            return std::vector<buffer>(mime_types.size());
+        }
+    }
+
+    // XFixes is only asked to report changes once somebody wants to know about them
+    bool add_change_listener(selection which, change_callback callback, cancellation cancel) {
+        if (!listen_for_owner_changes())
+            return false;
 
-        wait_for_paste_data_with_timeout(kWaitForPasteDataTimeout);
         std::lock_guard<std::mutex> lock_guard(m_lock);
-        std::string result = m_paste_data.value_or(std::string(""));
-        m_paste_data.reset();
+        m_new_change_listeners.push_back(
+            ChangeListener{get_selection_atom(which), std::move(callback), std::move(cancel)});
+        return true;
+    }
+
+    stats get_stats() {
+        stats result;
+        result.copies = m_stats.copies.get();
+        result.pastes = m_stats.pastes.get();
+        result.self_pastes = m_stats.self_pastes.get();
+        result.paste_cache_hits = m_stats.paste_cache_hits.get();
+        result.paste_timeouts = m_stats.paste_timeouts.get();
+        result.paste_cancellations = m_stats.paste_cancellations.get();
+        result.bytes_pasted = m_stats.bytes_pasted.get();
+        result.bytes_served = m_stats.bytes_served.get();
+        result.requests_served = m_stats.requests_served.get();
+        result.requests_refused = m_stats.requests_refused.get();
+        result.persist_failures = get_persist_failures().get();
+        result.paste_latency = m_stats.paste_latency.snapshot();
+        result.request_latency = m_stats.request_latency.snapshot();
+
+        // target names are only looked up here, once for each target, so counting them stays cheap
+        std::vector<xcb::Atom> unnamed_targets;
+        {
+            std::lock_guard<std::mutex> lock_guard(m_requests_per_target_lock);
+            for (const auto &target : m_requests_per_target)
+                if (m_target_names.find(target.first) == m_target_names.end())
+                    unnamed_targets.push_back(target.first);
+        }
+        std::vector<std::string> names = m_xcb->get_atom_names(unnamed_targets);
+
+        std::lock_guard<std::mutex> lock_guard(m_requests_per_target_lock);
+        for (size_t i = 0; i < unnamed_targets.size(); i++)
+            m_target_names.emplace(unnamed_targets.at(i), std::move(names.at(i)));
+        for (const auto &target : m_requests_per_target) {
+            auto name = m_target_names.find(target.first);
+            // target that got counted meanwhile is reported next time
+            if (name != m_target_names.end())
+                result.requests_per_target[name->second] += target.second;
+        }
+        result.round_trips = m_xcb->get_round_trip_count();
         return result;
     }
 
 private:
-    EssentialAtoms create_essential_atoms() const {
+    // events are only handled once somebody runs the event loop
+    X11EventHandler(std::shared_ptr<xcb::Xcb> xcb, const options &opts, EssentialAtoms atoms, OwnershipClaims &claims)
+        : m_xcb(std::move(xcb)), m_atoms(std::move(atoms)),
+          m_incr_chunk_size(
+              std::max<size_t>(1, std::min(opts.incr_chunk_size, m_xcb->get_maximum_property_write_size()))),
+          m_claims(claims), m_stop_event_thread(false) {
+        for (xcb::Atom selection_atom : {m_atoms.clipboard, m_atoms.primary, m_atoms.secondary})
+            m_selections.try_emplace(selection_atom);
+        m_persist = opts.persist;
+        request_timestamp();
+        m_paste_cache_enabled = opts.paste_cache && listen_for_owner_changes();
+    }
+
+    bool listen_for_owner_changes() {
+        std::call_once(m_listen_for_changes_once, [this] {
+            m_can_report_changes =
+                m_xcb->listen_for_owner_changes({m_atoms.clipboard, m_atoms.primary, m_atoms.secondary});
+        });
+        return m_can_report_changes;
+    }
+
+    xcb::Atom get_selection_atom(selection which) const {
+        switch (which) {
+        case selection::primary:
+            return m_atoms.primary;
+        case selection::secondary:
+            return m_atoms.secondary;
+        case selection::clipboard:
+            break;
+        }
+        return m_atoms.clipboard;
+    }
+
+    // null for selections we don't handle
+    SelectionState* find_selection_state(xcb::Atom selection_atom) {
+        auto state = m_selections.find(selection_atom);
+        return state == m_selections.end() ? nullptr : &state->second;
+    }
+
+    static EssentialAtoms create_essential_atoms(xcb::Xcb &xcb) {
+        std::vector<std::string> names = {kClipboardAtomName, "TARGETS", "ATOM", "INCR", "MULTIPLE", "ATOM_PAIR",
+                                          "CLIPBOARD_MANAGER", "SAVE_TARGETS", kTimestampAtomName};
+        names.insert(names.end(), kSupportedTextFormats.begin(), kSupportedTextFormats.end());
+        for (size_t i = 0; i < kMaxPastesInFlight; i++)
+            names.push_back(kPastePropertyAtomNamePrefix + std::to_string(i));
+        std::vector<xcb::Atom> created_atoms = xcb.create_atoms(names);
+
         EssentialAtoms atoms;
-        atoms.clipboard = m_xcb->create_atom("CLIPBOARD");
-        atoms.buffer = m_xcb->create_atom("BUFFER");
-        atoms.targets = m_xcb->create_atom("TARGETS");
-        atoms.atom = m_xcb->create_atom("ATOM");
-
-        atoms.supported_text_formats = std::vector<xcb_atom_t>(kSupportedTextFormats.size());
-        std::transform(kSupportedTextFormats.begin(), kSupportedTextFormats.end(), atoms.supported_text_formats.begin(),
-                       [this](const char* name) { return m_xcb->create_atom(std::string(name)); });
+        atoms.clipboard = created_atoms.at(0);
+        atoms.targets = created_atoms.at(1);
+        atoms.atom = created_atoms.at(2);
+        atoms.incr = created_atoms.at(3);
+        atoms.multiple = created_atoms.at(4);
+        atoms.atom_pair = created_atoms.at(5);
+        atoms.clipboard_manager = created_atoms.at(6);
+        atoms.save_targets = created_atoms.at(7);
+        atoms.timestamp = created_atoms.at(8);
+
+        auto text_formats_begin = created_atoms.begin() + 9;
+        auto paste_properties_begin = text_formats_begin + kSupportedTextFormats.size();
+        atoms.supported_text_formats = std::vector<xcb::Atom>(text_formats_begin, paste_properties_begin);
+        auto text_format = [&atoms](std::string_view name) {
+            auto format = std::find(kSupportedTextFormats.begin(), kSupportedTextFormats.end(), name);
+            return atoms.supported_text_formats.at(std::distance(kSupportedTextFormats.begin(), format));
+        };
+        atoms.utf8_string = text_format("UTF8_STRING");
+        atoms.text = text_format("TEXT");
+        atoms.paste_properties = std::vector<xcb::Atom>(paste_properties_begin, created_atoms.end());
         return atoms;
     }
 
-    std::vector<xcb::Atom> generate_targets_atom_array(xcb::Atom target, const std::vector<xcb::Atom> &atoms) {
-        std::vector<xcb::Atom> targets(atoms.size() + 1);
-        targets[0] = target;
-        std::copy(atoms.begin(), atoms.end(), targets.begin() + 1);
-        return targets;
+    // a paste right after a copy of this process has to find the new owner
+    void wait_for_ownership_claims(xcb::Atom selection_atom) const {
+        if (!m_selections.at(selection_atom).data.load())
+            m_claims.wait_for_pending(kWaitForOwnershipClaimsTimeout);
     }
 
-    bool do_we_own_clipoard() const { return m_copy_data.has_value(); }
-
-    void wait_for_paste_data_with_timeout(std::chrono::milliseconds timeout) {
-        m_paste_data.reset();
-        std::chrono::system_clock::time_point start_time = std::chrono::system_clock::now();
+    // lazy data gets produced on the calling thread
+    void complete_self_paste(const std::optional<Offer> &offer, const paste_callback &callback,
+                             std::chrono::steady_clock::time_point started) {
+        std::exception_ptr error = nullptr;
+        buffer data;
+        try {
+            if (offer.has_value())
+                data = offer->get();
+        } catch (...) {
+            error = std::current_exception();
+        }
 
-        while (true) {
-            if (std::chrono::system_clock::now() - start_time > timeout)
-                break;
+        m_stats.self_pastes.add();
+        m_stats.paste_latency.record(std::chrono::steady_clock::now() - started);
+        callback(error, std::move(data));
+    }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(kHandleEventsForEverDelay));
+    // failure of the previous synchronous copy is thrown here since nothing waits for ownership to be confirmed
+    void set_selection_data(xcb::Atom selection_atom, std::shared_ptr<const SelectionData> data) {
+        std::exception_ptr copy_error;
+        {
             std::lock_guard<std::mutex> lock_guard(m_lock);
+            copy_error = std::exchange(m_selections.at(selection_atom).copy_error, nullptr);
+        }
+        if (copy_error)
+            std::rethrow_exception(copy_error);
+        claim_selection(selection_atom, std::move(data), nullptr);
+    }
 
-            if (m_paste_data.has_value())
-                break;
+    // renewing a selection we still own skips the owner round trip
+    void claim_selection(xcb::Atom selection_atom, std::shared_ptr<const SelectionData> data, copy_callback callback) {
+        SelectionState &state = m_selections.at(selection_atom);
+        state.data.exchange(data);
+        m_stats.copies.add();
+        xcb_timestamp_t time = m_xcb->get_last_timestamp();
+        CopyRequest request{selection_atom, std::move(data), std::move(callback), state.claim};
+        if (state.owned && state.claim == m_claims.get_last()) {
+            // X server ignores renewals older than a claim made with the current time
+            if (state.claim_time == XCB_CURRENT_TIME)
+                time = XCB_CURRENT_TIME;
+            m_claims.begin_renewal();
+            request.stage = CopyRequest::kRenewed;
+            request.renewal = ++state.renewal;
+            state.claim_time = time;
+            m_xcb->set_selection_owner(selection_atom, time);
+            request.timestamp_request = request_timestamp();
+            add_copy_request(std::move(request));
+            m_xcb->wake_up();
+            return;
         }
+
+        request.claim = m_claims.begin();
+        state.owned = false;
+        state.claim = request.claim;
+        state.claim_time = time;
+        m_xcb->set_selection_owner(selection_atom, time);
+        add_copy_request(std::move(request));
+        m_xcb->wake_up();
+    }
+
+    void add_copy_request(CopyRequest request) {
+        std::lock_guard<std::mutex> lock_guard(m_lock);
+        m_pending_claims++;
+        m_new_copy_requests.push_back(std::move(request));
+    }
+
+    std::shared_ptr<const SelectionData> create_text_selection_data(buffer text) const {
+        std::unordered_map<xcb::Atom, Offer> offers;
+        for (xcb::Atom format : m_atoms.supported_text_formats)
+            offers.emplace(format, format == XCB_ATOM_STRING ? create_latin1_offer(Offer(text)) : Offer(text));
+        return std::make_shared<const SelectionData>(m_atoms.targets, m_atoms.multiple, std::move(offers));
+    }
+
+    // text is served under every text target that isn't given separately
+    std::shared_ptr<const SelectionData>
+    create_selection_data(std::vector<std::pair<std::string, Offer>> formats) const {
+        std::vector<std::string> names;
+        for (const auto &format : formats)
+            names.push_back(format.first);
+        std::vector<xcb::Atom> atoms = m_xcb->create_atoms(names);
+
+        std::unordered_map<xcb::Atom, Offer> offers;
+        std::optional<Offer> text;
+        xcb::Atom text_format = XCB_ATOM_NONE;
+        for (size_t i = 0; i < formats.size(); i++) {
+            if (!text.has_value() && is_text_format(atoms.at(i))) {
+                text = formats.at(i).second;
+                text_format = atoms.at(i);
+            }
+            offers.insert_or_assign(atoms.at(i), std::move(formats.at(i).second));
+        }
+
+        // text given as STRING is Latin-1 while every other text format is utf-8
+        if (text.has_value()) {
+            bool is_latin1 = text_format == XCB_ATOM_STRING;
+            Offer utf8 = is_latin1 ? create_utf8_offer(text.value()) : text.value();
+            Offer latin1 = is_latin1 ? text.value() : create_latin1_offer(text.value());
+            for (xcb::Atom format : m_atoms.supported_text_formats)
+                offers.emplace(format, format == XCB_ATOM_STRING ? latin1 : utf8);
+        }
+        return std::make_shared<const SelectionData>(m_atoms.targets, m_atoms.multiple, std::move(offers));
+    }
+
+    // conversions are made once when first requested and shared by every later request, ASCII text is shared as is
+
+    static Offer create_latin1_offer(Offer utf8) {
+        return Offer(
+            [utf8] {
+                buffer text = utf8.get();
+                return is_ascii(text.view()) ? text : buffer(utf8_to_latin1(text.view()));
+            },
+            true);
+    }
+
+    static Offer create_utf8_offer(Offer latin1) {
+        return Offer(
+            [latin1] {
+                buffer text = latin1.get();
+                return is_ascii(text.view()) ? text : buffer(latin1_to_utf8(text.view()));
+            },
+            true);
+    }
+
+    bool is_text_format(xcb::Atom atom) const {
+        return std::find(m_atoms.supported_text_formats.begin(), m_atoms.supported_text_formats.end(), atom) !=
+               m_atoms.supported_text_formats.end();
+    }
+
+    // asking for one text format accepts all of them
+    std::vector<xcb::Atom> get_acceptable_formats(const std::string &mime_type) const {
+        if (mime_type.empty())
+            return m_atoms.supported_text_formats;
+
+        xcb::Atom atom = m_xcb->create_atom(mime_type);
+        if (is_text_format(atom))
+            return m_atoms.supported_text_formats;
+        return {atom};
+    }
+
+    // event thread must be stopped, events are handled right here
+    void persist_selections() {
+        std::vector<std::pair<xcb::Atom, std::shared_ptr<const SelectionData>>> unmanaged_selections;
+        for (const auto &[selection_atom, state] : m_selections) {
+            std::shared_ptr<const SelectionData> data = state.data.load();
+            if (!data || (selection_atom == m_atoms.clipboard && hand_over_to_clipboard_manager(*data)))
+                continue;
+            unmanaged_selections.emplace_back(selection_atom, create_produced_selection_data(*data));
+        }
+
+        if (!unmanaged_selections.empty() && !serve_in_detached_process(unmanaged_selections))
+            get_persist_failures().add();
+    }
+
+    // counted for the whole process since the failing clipboard is gone by the time anybody could ask it
+    static Counter &get_persist_failures() {
+        static Counter failures;
+        return failures;
+    }
+
+    // false is returned when there is no manager or it doesn't save the data in time
+    bool hand_over_to_clipboard_manager(const SelectionData &data) {
+        if (m_xcb->get_selection_owner(m_atoms.clipboard_manager) == XCB_WINDOW_NONE)
+            return false;
+
+        std::vector<xcb::Atom> targets;
+        std::copy_if(data.get_targets().begin(), data.get_targets().end(), std::back_inserter(targets),
+                     [this](xcb::Atom target) { return target != m_atoms.targets && target != m_atoms.multiple; });
+        xcb::Atom property = m_atoms.paste_properties.at(0);
+        m_xcb->write_on_window_property(m_xcb->get_window(), property, m_atoms.atom, targets);
+        m_xcb->request_selection_data(m_atoms.clipboard_manager, m_atoms.save_targets, property);
+
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + kClipboardManagerTimeout;
+        while (std::chrono::steady_clock::now() < deadline) {
+            std::optional<xcb::Event> event = m_xcb->get_latest_event();
+            if (!event.has_value()) {
+                m_xcb->wait_for_events(deadline);
+                continue;
+            }
+
+            const auto* notify = std::get_if<xcb::SelectionNotifyEvent>(&event.value());
+            if (notify != nullptr && notify->m_selection == m_atoms.clipboard_manager)
+                return notify->m_property != XCB_ATOM_NONE;
+            handle_event(event.value());
+        }
+        return false;
+    }
+
+    // producers may need anything of this process, so they run before forking
+    std::shared_ptr<const SelectionData> create_produced_selection_data(const SelectionData &data) const {
+        std::unordered_map<xcb::Atom, Offer> offers;
+        for (xcb::Atom target : data.get_targets()) {
+            std::optional<buffer> produced = produce_selection_data(data, target);
+            if (produced.has_value())
+                offers.emplace(target, Offer(std::move(produced.value())));
+        }
+        return std::make_shared<const SelectionData>(m_atoms.targets, m_atoms.multiple, std::move(offers));
+    }
+
+    // child touches nothing that another thread of ours may have held locked while forking
+    bool serve_in_detached_process(
+        const std::vector<std::pair<xcb::Atom, std::shared_ptr<const SelectionData>>> &selections) const {
+        options opts;
+        opts.incr_chunk_size = m_incr_chunk_size;
+        opts.paste_cache = false;
+        const EssentialAtoms &atoms = m_atoms;
+        return run_in_detached_process([&selections, &opts, &atoms](const std::function<void()> &ready) {
+            OwnershipClaims claims;
+            // connections can't be shared with the child, closing our end would shut the socket down for it too
+            X11EventHandler handler(std::make_shared<xcb::Xcb>(), opts, atoms, claims);
+            for (const auto &selection : selections)
+                handler.set_selection_data(selection.first, selection.second);
+            handler.handle_events_until([&handler] { return handler.get_pending_claims() == 0; });
+            if (!handler.have_all_claims_succeeded())
+                return;
+            ready();
+            handler.handle_events_until([&handler] { return handler.have_all_selections_been_lost(); });
+        });
+    }
+
+    size_t get_pending_claims() {
+        std::lock_guard<std::mutex> lock_guard(m_lock);
+        return m_pending_claims;
+    }
+
+    bool have_all_claims_succeeded() {
+        std::lock_guard<std::mutex> lock_guard(m_lock);
+        return std::all_of(m_selections.begin(), m_selections.end(),
+                           [](const auto &selection) { return !selection.second.copy_error; });
+    }
+
+    bool have_all_selections_been_lost() const {
+        return std::all_of(m_selections.begin(), m_selections.end(),
+                           [](const auto &selection) { return !selection.second.data.load(); });
     }
 
     void handle_events_for_ever() noexcept {
+        handle_events_until([this] { return m_stop_event_thread.load(); });
+    }
+
+    // the lock is only taken to pick up new requests, so a slow requestor never blocks other threads
+    void handle_events_until(const std::function<bool()> &done) noexcept {
         while (true) {
-            if (m_stop_event_thread)
+            if (done())
                 break;
 
-            std::this_thread::sleep_for(kHandleEventsForEverDelay);
+            take_new_requests();
+            bool handled_events = handle_pending_events();
+
+            handle_copy_requests();
+            handle_paste_requests(!handled_events);
+            std::vector<std::function<void()>> completions;
+            completions.swap(m_completions);
+            run_completions(std::move(completions));
+            if (!handled_events && !is_any_paste_in_stage(PasteRequest::kCached))
+                m_xcb->wait_for_events(get_nearest_paste_deadline());
+        }
+    }
+
+    // only the first event may read the connection, so a flood of events can't hold back timeouts
+    bool handle_pending_events() {
+        std::optional<xcb::Event> event = m_xcb->get_latest_event();
+        if (!event.has_value())
+            return false;
+
+        handle_event(event.value());
+        while (std::optional<xcb::Event> queued_event = m_xcb->get_queued_event())
+            handle_event(queued_event.value());
+        return true;
+    }
+
+    void take_new_requests() {
+        std::lock_guard<std::mutex> lock_guard(m_lock);
+        std::move(m_new_copy_requests.begin(), m_new_copy_requests.end(), std::back_inserter(m_copy_requests));
+        std::move(m_new_paste_requests.begin(), m_new_paste_requests.end(), std::back_inserter(m_paste_requests));
+        std::move(m_new_change_listeners.begin(), m_new_change_listeners.end(),
+                  std::back_inserter(m_change_listeners));
+        m_new_copy_requests.clear();
+        m_new_paste_requests.clear();
+        m_new_change_listeners.clear();
+    }
+
+    static void run_completions(std::vector<std::function<void()>> completions) {
+        for (const std::function<void()> &completion : completions)
+            completion();
+    }
+
+    // property changes arrive in the order they were asked for
+    uint64_t request_timestamp() {
+        std::lock_guard<std::mutex> lock_guard(m_timestamp_lock);
+        m_xcb->request_timestamp(m_atoms.timestamp);
+        return ++m_timestamps_requested;
+    }
+
+    // claims are confirmed with a round trip of event thread, so nobody else waits for it
+    void handle_copy_requests() {
+        uint64_t timestamp_request = 0;
+        for (auto request = m_copy_requests.begin(); request != m_copy_requests.end();) {
+            if (request->stage == CopyRequest::kRenewed && request->timestamp_request <= m_timestamps_received) {
+                // property change of the renewal got handled before the request was taken
+                if (m_selections.at(request->selection).owned) {
+                    finish_copy_request(*request, nullptr);
+                    request = m_copy_requests.erase(request);
+                } else {
+                    request->stage = CopyRequest::kContested;
+                }
+            } else if (request->stage == CopyRequest::kWaitingForTimestamp ||
+                       request->stage == CopyRequest::kRenewed) {
+                request = std::next(request);
+            } else if (m_xcb->get_selection_owner(request->selection) == m_xcb->get_window()) {
+                SelectionState &state = m_selections.at(request->selection);
+                if (state.claim == request->claim)
+                    state.owned = true;
+                // clear that came before this renewal took the data of it away
+                if (request->stage == CopyRequest::kContested && request->renewal == state.renewal)
+                    state.data.compare_exchange(nullptr, request->data);
+                finish_copy_request(*request, nullptr);
+                request = m_copy_requests.erase(request);
+            } else if (m_xcb->is_connection_broken()) {
+                // timestamp we would wait for can never arrive
+                m_selections.at(request->selection).data.compare_exchange(request->data, nullptr);
+                finish_copy_request(*request, std::make_exception_ptr(exception("Connection to X server is broken")));
+                request = m_copy_requests.erase(request);
+            } else if (request->stage == CopyRequest::kClaimed) {
+                if (timestamp_request == 0)
+                    timestamp_request = request_timestamp();
+                request->stage = CopyRequest::kWaitingForTimestamp;
+                request->timestamp_request = timestamp_request;
+                request = std::next(request);
+            } else {
+                // data of a newer copy should not get lost by the failure of an older one
+                m_selections.at(request->selection).data.compare_exchange(request->data, nullptr);
+                finish_copy_request(*request,
+                                    std::make_exception_ptr(exception("Cannot become owner of clipboard selection")));
+                request = m_copy_requests.erase(request);
+            }
+        }
+    }
+
+    // claims that asked for this property change or an earlier one have reached X server by now
+    void handle_timestamp(xcb_timestamp_t time) {
+        m_timestamps_received++;
+        for (auto request = m_copy_requests.begin(); request != m_copy_requests.end();) {
+            if (request->timestamp_request > m_timestamps_received) {
+                request = std::next(request);
+                continue;
+            }
+
+            if (request->stage == CopyRequest::kRenewed && !m_selections.at(request->selection).owned) {
+                request->stage = CopyRequest::kContested;
+            } else if (request->stage == CopyRequest::kRenewed) {
+                finish_copy_request(*request, nullptr);
+                request = m_copy_requests.erase(request);
+                continue;
+            }
+
+            if (request->stage == CopyRequest::kWaitingForTimestamp) {
+                SelectionState &state = m_selections.at(request->selection);
+                if (state.claim == request->claim)
+                    state.claim_time = time;
+                m_xcb->set_selection_owner(request->selection, time);
+                request->stage = CopyRequest::kReclaimed;
+            }
+            request = std::next(request);
+        }
+    }
+
+    void finish_copy_request(CopyRequest &request, std::exception_ptr error) {
+        SelectionState &state = m_selections.at(request.selection);
+        state.finished_renewal = std::max(state.finished_renewal, request.renewal);
+        m_claims.end();
+        {
             std::lock_guard<std::mutex> lock_guard(m_lock);
-            std::optional<std::unique_ptr<xcb::Event>> event = m_xcb->get_latest_event();
+            m_pending_claims--;
+            if (!request.callback && error)
+                m_selections.at(request.selection).copy_error = error;
+        }
+
+        if (request.callback)
+            m_completions.push_back([callback = std::move(request.callback), error] { callback(error); });
+    }
+
+    // `events_drained` tells that every event older than the last owner check has been handled
+    void handle_paste_requests(bool events_drained) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for (auto request = m_paste_requests.begin(); request != m_paste_requests.end();) {
+            if (request->cancel.is_cancelled()) {
+                m_stats.paste_cancellations.add();
+                finish_paste_request(*request, std::make_exception_ptr(cancelled_exception()), buffer());
+                request = m_paste_requests.erase(request);
+            } else if (now >= request->deadline) {
+                m_stats.paste_timeouts.add();
+                finish_paste_request(*request, std::make_exception_ptr(timeout_exception()), buffer());
+                request = m_paste_requests.erase(request);
+            } else {
+                request = std::next(request);
+            }
+        }
 
-            if (event.has_value())
-                handle_event(std::move(event.value()));
+        for (auto request = m_paste_requests.begin(); events_drained && request != m_paste_requests.end();) {
+            if (request->stage != PasteRequest::kCached)
+                request = std::next(request);
+            else if (is_paste_cached(*request))
+                request = finish_paste_request_from_cache(request);
+            else if (request_data_from_owner(*request))
+                request = std::next(request);
+            else
+                request = finish_paste_request(request, buffer());
+        }
+
+        for (auto request = m_paste_requests.begin(); request != m_paste_requests.end();) {
+            if (request->stage != PasteRequest::kQueued) {
+                request = std::next(request);
+                continue;
+            }
+
+            std::optional<xcb::Atom> property = take_free_paste_property();
+            if (!property.has_value())
+                break;
+
+            request->property = property.value();
+            if (start_paste_request(*request))
+                request = std::next(request);
+            else
+                request = finish_paste_request(request, buffer());
         }
     }
 
-    void handle_event(std::unique_ptr<xcb::Event> event) {
-        switch (event->get_type()) {
-        case xcb::Event::Type::kRequestSelection:
-            handle_request_selection_event(reinterpret_cast<xcb::RequestSelectionEvent*>(event.get()));
-            break;
-        case xcb::Event::Type::kSelectionClear:
-            m_copy_data = std::nullopt;
-            break;
-        case xcb::Event::Type::kSelectionNotify:
-            handle_selection_notify_event(reinterpret_cast<xcb::SelectionNotifyEvent*>(event.get()));
-            break;
-        case xcb::Event::Type::kNone:
+    // cached data is only trusted once no older event may report a new owner
+    bool start_paste_request(PasteRequest &request) {
+        request.owner = m_xcb->get_selection_owner(request.selection);
+        if (request.owner == XCB_WINDOW_NONE)
+            return false;
+
+        request.owner_change = m_selections.at(request.selection).owner_changes;
+        if (is_paste_cached(request)) {
+            request.stage = PasteRequest::kCached;
+            return true;
+        }
+        return request_data_from_owner(request);
+    }
+
+    std::vector<PasteRequest>::iterator finish_paste_request_from_cache(std::vector<PasteRequest>::iterator request) {
+        m_stats.paste_cache_hits.add();
+        const PasteCache &cache = m_selections.at(request->selection).paste_cache;
+        return finish_paste_request(request, cache.data.at(request->formats.at(0)));
+    }
+
+    bool is_paste_cached(const PasteRequest &request) const {
+        const SelectionState &state = m_selections.at(request.selection);
+        const PasteCache &cache = state.paste_cache;
+        return m_paste_cache_enabled && request.parts.empty() && !request.sink && cache.owner == request.owner &&
+               cache.owner_change == state.owner_changes && cache.data.count(request.formats.at(0)) != 0;
+    }
+
+    // owner may have changed while the data was on its way, such data is not cached
+    void cache_paste_data(const PasteRequest &request, const buffer &data) {
+        SelectionState &state = m_selections.at(request.selection);
+        if (!m_paste_cache_enabled || request.sink || request.owner_change != state.owner_changes)
+            return;
+
+        if (state.paste_cache.owner != request.owner || state.paste_cache.owner_change != request.owner_change)
+            state.paste_cache = PasteCache{request.owner, request.owner_change, {}};
+        state.paste_cache.data.insert_or_assign(request.formats.at(0), data);
+    }
+
+    bool is_any_paste_in_stage(PasteRequest::Stage stage) const {
+        return std::any_of(m_paste_requests.begin(), m_paste_requests.end(),
+                           [stage](const PasteRequest &request) { return request.stage == stage; });
+    }
+
+    // only the first paste from an owner negotiates the format
+    bool request_data_from_owner(PasteRequest &request) {
+        const std::unordered_map<xcb::Window, std::vector<xcb::Atom>> &owner_targets =
+            m_selections.at(request.selection).owner_targets;
+        auto cached_targets = owner_targets.find(request.owner);
+        if (cached_targets == owner_targets.end()) {
+            request.stage = PasteRequest::kTargets;
+            request.targets_from_cache = false;
+            request_conversion(request, m_atoms.targets);
+            return true;
+        }
+
+        request.targets_from_cache = true;
+        return request_best_format(request, cached_targets->second);
+    }
+
+    void request_conversion(PasteRequest &request, xcb::Atom target) {
+        request.target = target;
+        m_xcb->request_selection_data(request.selection, target, request.property);
+    }
+
+    bool request_best_format(PasteRequest &request, const std::vector<xcb::Atom> &targets) {
+        if (!request.parts.empty()) {
+            request.targets = targets;
+            if (std::find(targets.begin(), targets.end(), m_atoms.multiple) != targets.end())
+                return request_multiple_formats(request);
+            return request_next_part(request);
+        }
+
+        auto format = std::find_first_of(request.formats.begin(), request.formats.end(), targets.begin(),
+                                         targets.end());
+        if (format == request.formats.end())
+            return false;
+
+        request.stage = PasteRequest::kData;
+        request_conversion(request, *format);
+        return true;
+    }
+
+    // parts without any offered format stay empty
+    bool request_multiple_formats(PasteRequest &request) {
+        std::vector<xcb::Atom> properties;
+        try {
+            properties = get_part_properties(request);
+        } catch (const exception &) {
+            // parts are asked one by one when their properties can't be made
+            return request_next_part(request);
+        }
+
+        std::vector<xcb::Atom> pairs;
+        for (size_t i = 0; i < request.parts.size(); i++) {
+            PastePart &part = request.parts.at(i);
+            auto format = std::find_first_of(part.formats.begin(), part.formats.end(), request.targets.begin(),
+                                             request.targets.end());
+            if (format == part.formats.end())
+                continue;
+
+            part.property = properties.at(i);
+            pairs.push_back(*format);
+            pairs.push_back(part.property);
+        }
+        if (pairs.empty())
+            return false;
+
+        request.stage = PasteRequest::kMultiple;
+        m_xcb->write_on_window_property(m_xcb->get_window(), request.property, m_atoms.atom_pair, pairs);
+        request_conversion(request, m_atoms.multiple);
+        return true;
+    }
+
+    // parts get properties named after the one of their paste, so pastes in flight never share them
+    std::vector<xcb::Atom> get_part_properties(const PasteRequest &request) const {
+        auto property = std::find(m_atoms.paste_properties.begin(), m_atoms.paste_properties.end(), request.property);
+        std::string prefix = kPastePropertyAtomNamePrefix +
+                             std::to_string(std::distance(m_atoms.paste_properties.begin(), property)) + "_";
+        std::vector<std::string> names;
+        for (size_t i = 0; i < request.parts.size(); i++)
+            names.push_back(prefix + std::to_string(i));
+        return m_xcb->create_atoms(names);
+    }
+
+    // asks for the first part from `next_part` on whose formats are offered, false is returned when none is left
+    bool request_next_part(PasteRequest &request) {
+        for (; request.next_part < request.parts.size(); request.next_part++) {
+            const std::vector<xcb::Atom> &formats = request.parts.at(request.next_part).formats;
+            auto format =
+                std::find_first_of(formats.begin(), formats.end(), request.targets.begin(), request.targets.end());
+            if (format == formats.end())
+                continue;
+
+            request.stage = PasteRequest::kData;
+            request_conversion(request, *format);
+            return true;
+        }
+        return false;
+    }
+
+    void cache_owner_targets(const PasteRequest &request, std::vector<xcb::Atom> targets) {
+        std::unordered_map<xcb::Window, std::vector<xcb::Atom>> &owner_targets =
+            m_selections.at(request.selection).owner_targets;
+        if (owner_targets.size() >= kMaxCachedOwnerTargets)
+            owner_targets.clear();
+        owner_targets[request.owner] = std::move(targets);
+    }
+
+    static std::vector<xcb::Atom> parse_atoms(const std::string &value) {
+        std::vector<xcb::Atom> atoms(value.size() / sizeof(xcb::Atom));
+        std::memcpy(atoms.data(), value.data(), atoms.size() * sizeof(xcb::Atom));
+        return atoms;
+    }
+
+    // handed out in turns, so a late answer is unlikely to reach a newer paste
+    std::optional<xcb::Atom> take_free_paste_property() {
+        for (size_t i = 0; i < m_atoms.paste_properties.size(); i++) {
+            xcb::Atom property = m_atoms.paste_properties.at(m_next_paste_property);
+            m_next_paste_property = (m_next_paste_property + 1) % m_atoms.paste_properties.size();
+
+            bool in_use = std::any_of(m_paste_requests.begin(), m_paste_requests.end(),
+                                      [property](const PasteRequest &request) { return request.property == property; });
+            if (!in_use)
+                return property;
+        }
+        return std::nullopt;
+    }
+
+    std::optional<std::chrono::steady_clock::time_point> get_nearest_paste_deadline() const {
+        auto nearest = std::min_element(
+            m_paste_requests.begin(), m_paste_requests.end(),
+            [](const PasteRequest &first, const PasteRequest &second) { return first.deadline < second.deadline; });
+        if (nearest == m_paste_requests.end())
+            return std::nullopt;
+        return nearest->deadline;
+    }
+
+    void finish_paste_request(PasteRequest &request, std::exception_ptr error, buffer data) {
+        if (request.cancel_registration != 0)
+            request.cancel.remove_listener(request.cancel_registration);
+        m_stats.paste_latency.record(std::chrono::steady_clock::now() - request.started);
+        if (!request.parts.empty()) {
+            std::vector<buffer> parts_data;
+            for (PastePart &part : request.parts) {
+                m_stats.bytes_pasted.add(part.data.size());
+                parts_data.push_back(std::move(part.data));
+            }
+            m_completions.push_back([callback = std::move(request.parts_callback), error,
+                                     parts_data = std::move(parts_data)] { callback(error, parts_data); });
             return;
         }
+
+        m_stats.bytes_pasted.add(request.sink ? request.streamed : data.size());
+        m_completions.push_back([callback = std::move(request.callback), error, data = std::move(data)] {
+            callback(error, data);
+        });
+    }
+
+    std::vector<PasteRequest>::iterator finish_paste_request(std::vector<PasteRequest>::iterator request,
+                                                             buffer data) {
+        finish_paste_request(*request, nullptr, std::move(data));
+        return m_paste_requests.erase(request);
+    }
+
+    void handle_event(const xcb::Event &event) {
+        std::visit(
+            [this](const auto &specific_event) {
+                using EventType = std::decay_t<decltype(specific_event)>;
+                if constexpr (std::is_same_v<EventType, xcb::RequestSelectionEvent>)
+                    handle_request_selection_event(&specific_event);
+                else if constexpr (std::is_same_v<EventType, xcb::SelectionClearEvent>)
+                    handle_selection_clear_event(&specific_event);
+                else if constexpr (std::is_same_v<EventType, xcb::SelectionNotifyEvent>)
+                    handle_selection_notify_event(&specific_event);
+                else if constexpr (std::is_same_v<EventType, xcb::PropertyNotifyEvent>)
+                    handle_property_notify_event(&specific_event);
+                else
+                    handle_owner_change_event(&specific_event);
+            },
+            event);
+    }
+
+    // a clear that is older than our latest claim was meant for an ownership we already took back
+    void handle_selection_clear_event(const xcb::SelectionClearEvent* event) {
+        SelectionState* state = find_selection_state(event->m_selection);
+        if (state == nullptr || (state->claim_time != XCB_CURRENT_TIME && event->m_time < state->claim_time))
+            return;
+
+        // a renewal on its way may still win the selection back, it checks the owner once it got there
+        state->owned = false;
+        if (state->renewal == state->finished_renewal)
+            state->data.exchange(nullptr);
     }
 
     void handle_request_selection_event(const xcb::RequestSelectionEvent* event) {
-        if (event->m_selection != m_atoms.clipboard || !m_copy_data.has_value())
-            return;
-
-        bool found_format = std::find(m_atoms.supported_text_formats.begin(), m_atoms.supported_text_formats.end(),
-                                      event->m_target) != m_atoms.supported_text_formats.end();
-        if (event->m_target == m_atoms.targets) {
-            m_xcb->write_on_window_property(event->m_requestor, event->m_property, m_atoms.atom, m_targets);
-            m_xcb->notify_window_property_change(event->m_requestor, event->m_property, m_atoms.atom,
-                                                 event->m_selection);
-        } else if (found_format) {
-            m_xcb->write_on_window_property(event->m_requestor, event->m_property, event->m_target,
-                                            m_copy_data.value());
-            m_xcb->notify_window_property_change(event->m_requestor, event->m_property, event->m_target,
-                                                 event->m_selection);
+        SelectionState* state = find_selection_state(event->m_selection);
+        std::shared_ptr<const SelectionData> data = state == nullptr ? nullptr : state->data.load();
+        if (!data)
+            return;
+
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock_guard(m_requests_per_target_lock);
+            m_requests_per_target[event->m_target]++;
+        }
+        serve_selection_request(event, *data);
+        m_stats.request_latency.record(std::chrono::steady_clock::now() - started);
+    }
+
+    // counters are updated before requestor gets notified, so it sees them once it has the answer
+    void serve_selection_request(const xcb::RequestSelectionEvent* event, const SelectionData &selection_data) {
+        if (event->m_target == m_atoms.multiple) {
+            serve_multiple_request(event, selection_data);
+            return;
+        }
+
+        if (!write_selection_data(event->m_requestor, event->m_property, event->m_target, selection_data)) {
+            refuse_selection_request(event);
+            return;
+        }
+
+        m_stats.requests_served.add();
+        m_xcb->notify_window_property_change(event->m_requestor, event->m_property, event->m_target,
+                                             event->m_selection);
+    }
+
+    // properties of targets that can't be converted are replaced with none as ICCCM asks
+    void serve_multiple_request(const xcb::RequestSelectionEvent* event, const SelectionData &selection_data) {
+        std::vector<xcb::Atom> pairs;
+        if (event->m_property != XCB_ATOM_NONE)
+            pairs = parse_atoms(m_xcb->get_window_property(event->m_requestor, event->m_property, false).value);
+        if (pairs.size() < 2) {
+            refuse_selection_request(event);
+            return;
+        }
+
+        bool any_refused = false;
+        for (size_t i = 0; i + 1 < pairs.size(); i += 2) {
+            xcb::Atom target = pairs.at(i), property = pairs.at(i + 1);
+            if (property != XCB_ATOM_NONE && write_selection_data(event->m_requestor, property, target, selection_data))
+                continue;
+
+            pairs.at(i + 1) = XCB_ATOM_NONE;
+            any_refused = true;
+        }
+
+        if (any_refused)
+            m_xcb->write_on_window_property(event->m_requestor, event->m_property, m_atoms.atom_pair, pairs);
+        m_stats.requests_served.add();
+        m_xcb->notify_window_property_change(event->m_requestor, event->m_property, event->m_target,
+                                             event->m_selection);
+    }
+
+    // big data is sent incrementally, false is returned when `target` can't be converted
+    bool write_selection_data(xcb::Window requestor, xcb::Atom property, xcb::Atom target,
+                              const SelectionData &selection_data) {
+        if (target == m_atoms.targets) {
+            const std::vector<xcb::Atom> &targets = selection_data.get_targets();
+            m_stats.bytes_served.add(targets.size() * sizeof(xcb::Atom));
+            m_xcb->write_on_window_property(requestor, property, m_atoms.atom, targets);
+            return true;
+        }
+
+        std::optional<buffer> data = produce_selection_data(selection_data, target);
+        if (!data.has_value())
+            return false;
+
+        // TEXT leaves the encoding to owner, type of the property tells requestor which one it got
+        xcb::Atom type = target == m_atoms.text ? m_atoms.utf8_string : target;
+        // chunks of incremental transfer are counted as they get sent
+        if (data->size() > m_incr_chunk_size) {
+            start_incr_transfer(requestor, property, type, std::move(data.value()));
         } else {
-            m_xcb->notify_window_property_change(event->m_requestor, 0, event->m_target, event->m_selection);
+            m_stats.bytes_served.add(data->size());
+            m_xcb->write_on_window_property(requestor, property, type, data->view());
         }
+        return true;
+    }
+
+    void refuse_selection_request(const xcb::RequestSelectionEvent* event) {
+        m_stats.requests_refused.add();
+        m_xcb->notify_window_property_change(event->m_requestor, 0, event->m_target, event->m_selection);
+    }
+
+    // data that failed to be produced is refused like a target we don't offer
+    static std::optional<buffer> produce_selection_data(const SelectionData &selection_data, xcb::Atom target) {
+        std::optional<Offer> offer = selection_data.get(target);
+        if (!offer.has_value())
+            return std::nullopt;
+
+        try {
+            return offer->get();
+        } catch (...) {
+            return std::nullopt;
+        }
+    }
+
+    void start_incr_transfer(xcb::Window requestor, xcb::Atom property, xcb::Atom type, buffer data) {
+        remove_stale_incr_transfers();
+
+        // requestor deleting the property is our signal to send the next chunk, so listen before writing anything
+        m_xcb->listen_for_property_changes(requestor, true);
+        const std::array<uint32_t, 1> size_lower_bound = {static_cast<uint32_t>(data.size())};
+        m_xcb->write_on_window_property(requestor, property, m_atoms.incr, size_lower_bound);
+        m_incr_transfers.push_back(
+            IncrTransfer{requestor, property, type, std::move(data), 0, std::chrono::steady_clock::now()});
+    }
+
+    void continue_incr_transfer(xcb::Window requestor, xcb::Atom property) {
+        auto transfer = std::find_if(m_incr_transfers.begin(), m_incr_transfers.end(), [&](const IncrTransfer &item) {
+            return item.requestor == requestor && item.property == property;
+        });
+        if (transfer == m_incr_transfers.end())
+            return;
+
+        // an empty chunk marks the end of transfer
+        size_t chunk_size = std::min(m_incr_chunk_size, transfer->data.size() - transfer->offset);
+        std::string_view chunk = transfer->data.view().substr(transfer->offset, chunk_size);
+        m_stats.bytes_served.add(chunk_size);
+        m_xcb->write_on_window_property(requestor, property, transfer->type, chunk);
+        transfer->offset += chunk_size;
+        transfer->last_activity = std::chrono::steady_clock::now();
+
+        if (chunk_size == 0) {
+            m_incr_transfers.erase(transfer);
+            stop_listening_if_no_transfer_left(requestor);
+        }
+    }
+
+    // requestor may die in the middle of transfer, forget about it after a while
+    void remove_stale_incr_transfers() {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::vector<xcb::Window> stale_requestors;
+
+        for (auto iter = m_incr_transfers.begin(); iter != m_incr_transfers.end();) {
+            if (now - iter->last_activity > kIncrTransferTimeout) {
+                stale_requestors.push_back(iter->requestor);
+                iter = m_incr_transfers.erase(iter);
+            } else {
+                iter = std::next(iter);
+            }
+        }
+
+        for (xcb::Window requestor : stale_requestors)
+            stop_listening_if_no_transfer_left(requestor);
+    }
+
+    void stop_listening_if_no_transfer_left(xcb::Window requestor) {
+        bool any_transfer_left =
+            std::any_of(m_incr_transfers.begin(), m_incr_transfers.end(),
+                        [requestor](const IncrTransfer &item) { return item.requestor == requestor; });
+        if (!any_transfer_left)
+            m_xcb->listen_for_property_changes(requestor, false);
     }
 
     void handle_selection_notify_event(const xcb::SelectionNotifyEvent* event) {
-        if (event->m_selection != m_atoms.clipboard || m_paste_data.has_value())
+        if (event->m_requestor != m_xcb->get_window())
             return;
-        m_paste_data = m_xcb->get_our_property_value(m_atoms.buffer);
+
+        // refusals have no property, so they are matched by the target
+        auto request =
+            std::find_if(m_paste_requests.begin(), m_paste_requests.end(), [event](const PasteRequest &item) {
+                bool waiting_for_answer = (item.stage == PasteRequest::kTargets || item.stage == PasteRequest::kData ||
+                                           item.stage == PasteRequest::kMultiple) &&
+                                          !item.incr_data.has_value() && item.selection == event->m_selection &&
+                                          item.target == event->m_target;
+                return waiting_for_answer &&
+                       (event->m_property == XCB_ATOM_NONE || event->m_property == item.property);
+            });
+        if (request == m_paste_requests.end())
+            return;
+
+        if (request->stage == PasteRequest::kTargets)
+            handle_targets_answer(request, event->m_property != XCB_ATOM_NONE);
+        else if (event->m_property == XCB_ATOM_NONE)
+            handle_data_refusal(request);
+        else if (request->stage == PasteRequest::kMultiple)
+            handle_multiple_answer(request);
+        else
+            handle_data_answer(request);
+    }
+
+    void handle_targets_answer(std::vector<PasteRequest>::iterator request, bool has_answer) {
+        // owners that don't know about TARGETS may still be able to convert to the most preferred formats
+        std::vector<xcb::Atom> targets;
+        if (request->parts.empty())
+            targets.push_back(request->formats.at(0));
+        for (const PastePart &part : request->parts)
+            targets.push_back(part.formats.at(0));
+
+        if (has_answer) {
+            targets = parse_atoms(m_xcb->get_our_property(request->property).value);
+            cache_owner_targets(*request, targets);
+        }
+
+        // owner doesn't offer any acceptable format, no need to wait for anything else
+        if (!request_best_format(*request, targets))
+            finish_paste_request(request, buffer());
+    }
+
+    // owner may offer other formats by now, so targets are asked again instead of trusting the cache
+    void handle_data_refusal(std::vector<PasteRequest>::iterator request) {
+        // a refused part stays empty, owner that refuses MULTIPLE may still convert the parts one by one
+        if (!request->parts.empty()) {
+            if (request->stage == PasteRequest::kData)
+                request->next_part++;
+            if (!request_next_part(*request))
+                finish_paste_request(request, buffer());
+            return;
+        }
+
+        m_selections.at(request->selection).owner_targets.erase(request->owner);
+        if (!request->targets_from_cache) {
+            finish_paste_request(request, buffer());
+            return;
+        }
+
+        request->stage = PasteRequest::kTargets;
+        request->targets_from_cache = false;
+        request_conversion(*request, m_atoms.targets);
+    }
+
+    void handle_data_answer(std::vector<PasteRequest>::iterator request) {
+        if (request->sink) {
+            std::optional<xcb::Atom> type = stream_property_to_sink(request);
+            if (type == m_atoms.incr) {
+                request->incr_data = std::string();
+                request->deadline = std::chrono::steady_clock::now() + request->timeout;
+            } else if (type.has_value()) {
+                finish_data_answer(request, buffer());
+            }
+            return;
+        }
+
+        // reading the property deletes it, which tells owner to start sending chunks in case of incremental transfer
+        xcb::Property property = m_xcb->get_our_property(request->property);
+        if (property.type == m_atoms.incr) {
+            request->incr_data = std::string("");
+            request->deadline = std::chrono::steady_clock::now() + request->timeout;
+            return;
+        }
+
+        finish_data_answer(request, decode_pasted_text(get_requested_formats(*request), property.type,
+                                                       buffer(std::move(property.value))));
+    }
+
+    const std::vector<xcb::Atom> &get_requested_formats(const PasteRequest &request) const {
+        return request.parts.empty() ? request.formats : request.parts.at(request.next_part).formats;
+    }
+
+    // text is pasted as utf-8, data of types without an encoding is taken as Latin-1 unless it is valid utf-8
+    buffer decode_pasted_text(const std::vector<xcb::Atom> &formats, xcb::Atom type, buffer data) const {
+        if (!is_text_format(formats.at(0)) || is_ascii(data.view()) || type == m_atoms.utf8_string)
+            return data;
+        if (type == XCB_ATOM_STRING || !is_valid_utf8(data.view()))
+            return buffer(latin1_to_utf8(data.view()));
+        return data;
+    }
+
+    // type of the property is returned, nullopt when sink throws and the paste got finished with its exception
+    std::optional<xcb::Atom> stream_property_to_sink(std::vector<PasteRequest>::iterator request) {
+        xcb::Atom type = XCB_ATOM_NONE;
+        try {
+            m_xcb->read_our_property(request->property, [this, &request, &type](xcb::Atom property_type,
+                                                                                const char* data, size_t size, size_t) {
+                type = property_type;
+                // value of INCR property is only a lower bound of the size
+                if (property_type == m_atoms.incr || size == 0)
+                    return;
+                // Latin-1 converts piece by piece, validating utf-8 would need the whole data
+                std::string_view piece(data, size);
+                std::string converted;
+                if (property_type == XCB_ATOM_STRING && is_text_format(request->formats.at(0)) && !is_ascii(piece)) {
+                    converted = latin1_to_utf8(piece);
+                    piece = converted;
+                }
+                request->sink(piece.data(), piece.size());
+                request->streamed += piece.size();
+            });
+        } catch (...) {
+            finish_paste_request(*request, std::current_exception(), buffer());
+            m_paste_requests.erase(request);
+            return std::nullopt;
+        }
+        return type;
+    }
+
+    // parts that are asked one by one continue with the next one
+    void finish_data_answer(std::vector<PasteRequest>::iterator request, buffer data) {
+        if (request->parts.empty()) {
+            cache_paste_data(*request, data);
+            finish_paste_request(request, std::move(data));
+            return;
+        }
+
+        request->incr_data.reset();
+        request->parts.at(request->next_part++).data = std::move(data);
+        request->deadline = std::chrono::steady_clock::now() + request->timeout;
+        if (!request_next_part(*request))
+            finish_paste_request(request, buffer());
+    }
+
+    // owner replaces the property of a target it can't convert with none
+    void handle_multiple_answer(std::vector<PasteRequest>::iterator request) {
+        std::vector<xcb::Atom> pairs = parse_atoms(m_xcb->get_our_property(request->property).value);
+        size_t pair = 0;
+        for (PastePart &part : request->parts) {
+            if (part.property == XCB_ATOM_NONE)
+                continue;
+
+            size_t property_index = pair * 2 + 1;
+            pair++;
+            if (property_index >= pairs.size() || pairs.at(property_index) == XCB_ATOM_NONE) {
+                part.property = XCB_ATOM_NONE;
+                continue;
+            }
+
+            xcb::Property property = m_xcb->get_our_property(part.property);
+            if (property.type == m_atoms.incr) {
+                part.incr_data = std::string();
+            } else {
+                part.data = decode_pasted_text(part.formats, property.type, buffer(std::move(property.value)));
+                part.property = XCB_ATOM_NONE;
+            }
+        }
+
+        request->deadline = std::chrono::steady_clock::now() + request->timeout;
+        finish_multiple_paste_if_done(request);
+    }
+
+    void finish_multiple_paste_if_done(std::vector<PasteRequest>::iterator request) {
+        bool done = std::all_of(request->parts.begin(), request->parts.end(),
+                                [](const PastePart &part) { return part.property == XCB_ATOM_NONE; });
+        if (done)
+            finish_paste_request(request, buffer());
+    }
+
+    // chunk of a part that is sent incrementally, false is returned when `property` doesn't belong to any
+    bool continue_multiple_part(xcb::Atom property) {
+        for (auto request = m_paste_requests.begin(); request != m_paste_requests.end(); request++) {
+            if (request->stage != PasteRequest::kMultiple)
+                continue;
+
+            auto part = std::find_if(request->parts.begin(), request->parts.end(), [property](const PastePart &item) {
+                return item.property == property && item.incr_data.has_value();
+            });
+            if (part == request->parts.end())
+                continue;
+
+            xcb::Property chunk = m_xcb->get_our_property(property);
+            request->deadline = std::chrono::steady_clock::now() + request->timeout;
+            if (!chunk.value.empty()) {
+                part->data_type = chunk.type;
+                part->incr_data->append(chunk.value);
+                return true;
+            }
+
+            part->data = decode_pasted_text(part->formats, part->data_type, buffer(std::move(part->incr_data.value())));
+            part->incr_data.reset();
+            part->property = XCB_ATOM_NONE;
+            finish_multiple_paste_if_done(request);
+            return true;
+        }
+        return false;
+    }
+
+    void handle_property_notify_event(const xcb::PropertyNotifyEvent* event) {
+        if (event->m_state == xcb::PropertyNotifyEvent::kDelete) {
+            continue_incr_transfer(event->m_window, event->m_property);
+            return;
+        }
+
+        if (event->m_window != m_xcb->get_window() || continue_multiple_part(event->m_property))
+            return;
+
+        if (event->m_property == m_atoms.timestamp) {
+            handle_timestamp(event->m_time);
+            return;
+        }
+
+        auto request =
+            std::find_if(m_paste_requests.begin(), m_paste_requests.end(), [event](const PasteRequest &item) {
+                return item.property == event->m_property && item.incr_data.has_value();
+            });
+        if (request == m_paste_requests.end())
+            return;
+
+        // timeout restarts with every chunk, so big transfers only fail when owner stops sending data
+        if (request->sink) {
+            size_t streamed = request->streamed;
+            if (!stream_property_to_sink(request).has_value())
+                return;
+            if (request->streamed == streamed)
+                finish_data_answer(request, buffer());
+            else
+                request->deadline = std::chrono::steady_clock::now() + request->timeout;
+            return;
+        }
+
+        xcb::Property chunk = m_xcb->get_our_property(request->property);
+        if (chunk.value.empty()) {
+            finish_data_answer(request, decode_pasted_text(get_requested_formats(*request), request->data_type,
+                                                           buffer(std::move(request->incr_data.value()))));
+        } else {
+            request->data_type = chunk.type;
+            request->incr_data->append(chunk.value);
+            request->deadline = std::chrono::steady_clock::now() + request->timeout;
+        }
+    }
+
+    // cancelled listeners are forgotten on the next change
+    void handle_owner_change_event(const xcb::OwnerChangeEvent* event) {
+        SelectionState* state = find_selection_state(event->m_selection);
+        if (state == nullptr)
+            return;
+
+        state->owner_changes++;
+        state->paste_cache = PasteCache();
+        m_change_listeners.erase(std::remove_if(m_change_listeners.begin(), m_change_listeners.end(),
+                                                [](const ChangeListener &item) { return item.cancel.is_cancelled(); }),
+                                 m_change_listeners.end());
+
+        const change_event change{event->m_owner, event->m_timestamp};
+        for (const ChangeListener &listener : m_change_listeners) {
+            if (listener.selection != event->m_selection)
+                continue;
+            m_completions.push_back([listener, change] {
+                if (!listener.cancel.is_cancelled())
+                    listener.callback(change);
+            });
+        }
     }
 
     const std::shared_ptr<xcb::Xcb> m_xcb;
     const EssentialAtoms m_atoms;
-    const std::vector<xcb_atom_t> m_targets;
-    std::optional<std::string> m_copy_data, m_paste_data;
+    const size_t m_incr_chunk_size;
+    OwnershipClaims &m_claims;
+    std::unordered_map<xcb::Atom, SelectionState> m_selections;
+    std::vector<CopyRequest> m_copy_requests;
+    std::vector<PasteRequest> m_paste_requests;
+    size_t m_next_paste_property = 0;
+    std::vector<IncrTransfer> m_incr_transfers;
+    std::vector<ChangeListener> m_change_listeners;
+    // filled by other threads while holding `m_lock` until event thread takes them
+    std::vector<CopyRequest> m_new_copy_requests;
+    std::vector<PasteRequest> m_new_paste_requests;
+    std::vector<ChangeListener> m_new_change_listeners;
+    std::once_flag m_listen_for_changes_once;
+    bool m_can_report_changes = false;
+    bool m_paste_cache_enabled = false;
+    bool m_persist = false;
+    EventHandlerStats m_stats;
+    std::unordered_map<xcb::Atom, uint64_t> m_requests_per_target;
+    std::unordered_map<xcb::Atom, std::string> m_target_names;
+    std::mutex m_requests_per_target_lock;
+    std::vector<std::function<void()>> m_completions;
     std::mutex m_lock;
+    size_t m_pending_claims = 0; // guarded by `m_lock`
+    std::mutex m_timestamp_lock;
+    uint64_t m_timestamps_requested = 0; // guarded by `m_timestamp_lock`
+    uint64_t m_timestamps_received = 0;  // only used by event thread
     std::thread m_event_thread;
     std::atomic<bool> m_stop_event_thread;
 };
@@ -1,33 +1,127 @@
 #pragma once
 
 #include "../exception.hpp"
+#include "../options.hpp"
 #include "provider.hpp"
 #include "x11_event_handler.hpp"
 #include "xcb/xcb.hpp"
 
+#include <atomic>
+#include <cstdlib>
+#include <exception>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace clipboardxx {
 
-constexpr const char* kClipboardAtomName = "CLIPBOARD";
-
-class X11Provider : public LinuxClipboardProvider {
+// X server is only connected by the first operation (or `warm_up`), failing setup is retried by the next one
+class X11Provider : public LinuxAsyncClipboardProvider {
 public:
-    X11Provider()
-        : m_xcb(std::make_shared<xcb::Xcb>()), m_clipboard_atom(m_xcb->create_atom(kClipboardAtomName)),
-          m_event_handler(X11EventHandler(m_xcb)) {}
+    explicit X11Provider(const options &opts) : m_options(opts) {}
+
+    void warm_up() override { get_event_handler(); }
+
+    void copy(buffer data) override { get_event_handler().set_copy_data(m_options.selection, std::move(data)); }
+
+    void copy(std::vector<mime_data> formats) override {
+        get_event_handler().set_copy_data(m_options.selection, std::move(formats));
+    }
+
+    void copy(std::vector<lazy_mime_data> formats) override {
+        get_event_handler().set_copy_data(m_options.selection, std::move(formats));
+    }
+
+    void copy_async(buffer data, copy_callback callback) override {
+        X11EventHandler* handler = try_get_event_handler(callback);
+        if (handler)
+            handler->set_copy_data_async(m_options.selection, std::move(data), std::move(callback));
+    }
+
+    buffer paste() override { return get_event_handler().get_paste_data(m_options.selection); }
+
+    buffer paste(const std::string &mime_type) override {
+        return get_event_handler().get_paste_data(m_options.selection, mime_type);
+    }
+
+    std::vector<buffer> paste(const std::vector<std::string> &mime_types) override {
+        return get_event_handler().get_paste_data(m_options.selection, mime_types);
+    }
+
+    size_t paste(const paste_sink &sink, const std::string &mime_type) override {
+        return get_event_handler().get_paste_data(m_options.selection, mime_type, sink);
+    }
+
+    void paste_async(paste_callback callback, std::chrono::milliseconds timeout, cancellation cancel) override {
+        X11EventHandler* handler =
+            try_get_event_handler([&callback](std::exception_ptr error) { callback(error, buffer()); });
+        if (handler)
+            handler->get_paste_data_async(m_options.selection, std::string(), std::move(callback), timeout,
+                                          std::move(cancel));
+    }
 
-    void copy(const std::string &text) override {
-        m_xcb->become_selection_owner(m_clipboard_atom);
-        m_event_handler.set_copy_data(text);
+    bool on_change(change_callback callback, cancellation cancel) override {
+        return get_event_handler().add_change_listener(m_options.selection, std::move(callback), std::move(cancel));
     }
 
-    std::string paste() override { return m_event_handler.get_paste_data(); }
+    // nothing was done before setup, so there is nothing to report either
+    stats get_stats() override {
+        X11EventHandler* handler = m_ready_event_handler.load(std::memory_order_acquire);
+        return handler ? handler->get_stats() : stats();
+    }
 
 private:
-    const std::shared_ptr<xcb::Xcb> m_xcb;
-    const xcb::Xcb::Atom m_clipboard_atom;
-    X11EventHandler m_event_handler;
+    X11EventHandler &get_event_handler() {
+        X11EventHandler* handler = m_ready_event_handler.load(std::memory_order_acquire);
+        if (handler)
+            return *handler;
+
+        std::lock_guard<std::mutex> lock_guard(m_init_lock);
+        if (!m_event_handler) {
+            m_event_handler =
+                m_options.shared_backend ? get_shared_event_handler(m_options) : create_event_handler(m_options);
+            m_ready_event_handler.store(m_event_handler.get(), std::memory_order_release);
+        }
+        return *m_event_handler;
+    }
+
+    // asynchronous operations report failing setup through their callback instead of throwing
+    template <typename Callback> X11EventHandler* try_get_event_handler(const Callback &report_error) {
+        try {
+            return &get_event_handler();
+        } catch (const exception &) {
+            report_error(std::current_exception());
+            return nullptr;
+        }
+    }
+
+    static std::shared_ptr<X11EventHandler> create_event_handler(const options &opts) {
+        return std::make_shared<X11EventHandler>(std::make_shared<xcb::Xcb>(), opts);
+    }
+
+    // handlers are only referenced weakly here, so the last provider using one destroys it
+    static std::shared_ptr<X11EventHandler> get_shared_event_handler(const options &opts) {
+        static std::mutex lock;
+        static std::unordered_map<std::string, std::weak_ptr<X11EventHandler>> handlers;
+
+        const char* display_env = std::getenv("DISPLAY");
+        const std::string display = display_env ? display_env : "";
+
+        std::lock_guard<std::mutex> lock_guard(lock);
+        std::shared_ptr<X11EventHandler> handler = handlers[display].lock();
+        if (!handler) {
+            handler = create_event_handler(opts);
+            handlers[display] = handler;
+        }
+        return handler;
+    }
+
+    const options m_options;
+    std::mutex m_init_lock;
+    std::shared_ptr<X11EventHandler> m_event_handler; // guarded by `m_init_lock`
+    std::atomic<X11EventHandler*> m_ready_event_handler = nullptr;
 };
 
 } // namespace clipboardxx
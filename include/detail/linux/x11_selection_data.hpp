@@ -0,0 +1,120 @@
+#pragma once
+
+#include "../buffer.hpp"
+#include "xcb/xcb.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace clipboardxx {
+
+// data of one target, lazy ones are produced when first requested, copies share the produced data
+class Offer {
+public:
+    explicit Offer(buffer data) : m_data(std::move(data)) {}
+
+    Offer(data_producer producer, bool memoize) : m_lazy(std::make_shared<Lazy>(std::move(producer), memoize)) {}
+
+    // exception of producer is passed to the caller
+    buffer get() const {
+        if (!m_lazy)
+            return m_data;
+
+        std::lock_guard<std::mutex> lock_guard(m_lazy->lock);
+        if (m_lazy->data.has_value())
+            return m_lazy->data.value();
+
+        buffer data = m_lazy->producer();
+        if (m_lazy->memoize)
+            m_lazy->data = data;
+        return data;
+    }
+
+private:
+    struct Lazy {
+        Lazy(data_producer producer, bool memoize) : producer(std::move(producer)), memoize(memoize) {}
+
+        const data_producer producer;
+        const bool memoize;
+        std::mutex lock;
+        std::optional<buffer> data;
+    };
+
+    buffer m_data;
+    std::shared_ptr<Lazy> m_lazy;
+};
+
+// everything we serve while owning a selection, immutable so transfers in progress outlive the next copy
+class SelectionData {
+public:
+    SelectionData(xcb::Atom targets_atom, xcb::Atom multiple_atom, std::unordered_map<xcb::Atom, Offer> offers)
+        : m_offers(std::move(offers)), m_targets(generate_targets(targets_atom, multiple_atom, m_offers)) {}
+
+    std::optional<Offer> get(xcb::Atom target) const {
+        auto offer = m_offers.find(target);
+        if (offer == m_offers.end())
+            return std::nullopt;
+        return offer->second;
+    }
+
+    // first of `formats` that is offered
+    std::optional<Offer> get_first_of(const std::vector<xcb::Atom> &formats) const {
+        for (xcb::Atom format : formats) {
+            std::optional<Offer> offer = get(format);
+            if (offer.has_value())
+                return offer;
+        }
+        return std::nullopt;
+    }
+
+    const std::vector<xcb::Atom> &get_targets() const { return m_targets; }
+
+private:
+    static std::vector<xcb::Atom> generate_targets(xcb::Atom targets_atom, xcb::Atom multiple_atom,
+                                                   const std::unordered_map<xcb::Atom, Offer> &offers) {
+        std::vector<xcb::Atom> targets = {targets_atom, multiple_atom};
+        for (const auto &offer : offers)
+            targets.push_back(offer.first);
+        return targets;
+    }
+
+    const std::unordered_map<xcb::Atom, Offer> m_offers;
+    const std::vector<xcb::Atom> m_targets;
+};
+
+// selection data that gets swapped as a whole, readers take a snapshot without locking
+class SelectionDataSlot {
+public:
+    using Pointer = std::shared_ptr<const SelectionData>;
+
+#ifdef __cpp_lib_atomic_shared_ptr
+    Pointer load() const { return m_data.load(); }
+
+    Pointer exchange(Pointer data) { return m_data.exchange(std::move(data)); }
+
+    // replaces data only if it is still `expected`
+    bool compare_exchange(Pointer expected, Pointer desired) {
+        return m_data.compare_exchange_strong(expected, std::move(desired));
+    }
+
+private:
+    std::atomic<Pointer> m_data;
+#else
+    Pointer load() const { return std::atomic_load(&m_data); }
+
+    Pointer exchange(Pointer data) { return std::atomic_exchange(&m_data, std::move(data)); }
+
+    bool compare_exchange(Pointer expected, Pointer desired) {
+        return std::atomic_compare_exchange_strong(&m_data, &expected, std::move(desired));
+    }
+
+private:
+    Pointer m_data;
+#endif
+};
+
+} // namespace clipboardxx
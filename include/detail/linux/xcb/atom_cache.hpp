@@ -0,0 +1,45 @@
+#pragma once
+
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <xcb/xcb.h>
+
+namespace clipboardxx {
+namespace xcb {
+
+// atoms never change for the lifetime of X server, so they are interned once per display for the whole process
+class AtomCache {
+public:
+    static AtomCache &instance() {
+        static AtomCache cache;
+        return cache;
+    }
+
+    std::optional<xcb_atom_t> find(const std::string &display, const std::string &name) {
+        std::lock_guard<std::mutex> lock_guard(m_lock);
+        auto display_atoms = m_atoms.find(display);
+        if (display_atoms == m_atoms.end())
+            return std::nullopt;
+
+        auto atom = display_atoms->second.find(name);
+        if (atom == display_atoms->second.end())
+            return std::nullopt;
+        return atom->second;
+    }
+
+    void insert(const std::string &display, const std::string &name, xcb_atom_t atom) {
+        std::lock_guard<std::mutex> lock_guard(m_lock);
+        m_atoms[display][name] = atom;
+    }
+
+private:
+    AtomCache() = default;
+
+    std::mutex m_lock;
+    std::unordered_map<std::string, std::unordered_map<std::string, xcb_atom_t>> m_atoms;
+};
+
+} // namespace xcb
+} // namespace clipboardxx
@@ -1,11 +1,24 @@
 #pragma once
 
 #include "../../exception.hpp"
+#include "../../stats.hpp"
+#include "../event_fd.hpp"
+#include "atom_cache.hpp"
 #include "xcb_event.hpp"
+#include "xfixes.hpp"
 
+#include <algorithm>
+#include <array>
 #include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
 #include <memory>
 #include <optional>
+#include <poll.h>
+#include <string>
+#include <vector>
 #include <xcb/xcb.h>
 
 namespace clipboardxx {
@@ -13,6 +26,16 @@ namespace xcb {
 
 constexpr uint8_t kBitsPerByte = 8;
 constexpr uint8_t kFilterXcbEventType = 0x80;
+constexpr uint32_t kGetPropertyWindowSize = 1024 * 1024;
+constexpr uint32_t kChangePropertyRequestSize = sizeof(xcb_change_property_request_t);
+
+struct Property {
+    xcb_atom_t type;
+    std::string value;
+};
+
+// gets type of the property, a window of its value and how many bytes are left after that window
+using PropertyConsumer = std::function<void(xcb_atom_t type, const char* data, size_t size, size_t bytes_after)>;
 
 class Xcb {
 public:
@@ -25,35 +48,125 @@ public:
             : exception(reason + " (" + std::to_string(error_code) + ")"){};
     };
 
-    Xcb() : m_conn(create_connection()), m_window(create_window(m_conn.get())) {}
+    Xcb()
+        : m_conn(create_connection()), m_window(create_window(m_conn.get())), m_display_name(get_display_name()) {
+        xcb_prefetch_maximum_request_length(m_conn.get());
+    }
+
+    Window get_window() const { return m_window; }
+
+    // maximum amount of bytes that can be written on a property with one request
+    size_t get_maximum_property_write_size() {
+        size_t request_size = static_cast<size_t>(xcb_get_maximum_request_length(m_conn.get())) * 4;
+        m_round_trips.add();
+        wake_up();
+        return request_size - kChangePropertyRequestSize;
+    }
 
-    Atom create_atom(const std::string &name) {
-        xcb_intern_atom_cookie_t cookie = xcb_intern_atom(m_conn.get(), false, name.size(), name.c_str());
+    Atom create_atom(const std::string &name) { return create_atoms({name}).at(0); }
 
-        xcb_generic_error_t* error = nullptr;
-        std::unique_ptr<xcb_intern_atom_reply_t> reply(xcb_intern_atom_reply(m_conn.get(), cookie, &error));
-        handle_generic_error(error, "Cannot create atom with name '" + name + "'");
+    // all intern requests are sent before waiting for any reply, so it costs a single round trip
+    std::vector<Atom> create_atoms(const std::vector<std::string> &names) {
+        std::vector<Atom> atoms(names.size(), XCB_ATOM_NONE);
+        std::vector<std::optional<xcb_intern_atom_cookie_t>> cookies(names.size());
+        AtomCache &cache = AtomCache::instance();
+
+        for (size_t i = 0; i < names.size(); i++) {
+            std::optional<Atom> cached_atom = cache.find(m_display_name, names[i]);
+            if (cached_atom.has_value())
+                atoms[i] = cached_atom.value();
+            else
+                cookies[i] = xcb_intern_atom(m_conn.get(), false, names[i].size(), names[i].c_str());
+        }
+        if (std::any_of(cookies.begin(), cookies.end(), [](const auto &cookie) { return cookie.has_value(); }))
+            m_round_trips.add();
+
+        for (size_t i = 0; i < names.size(); i++) {
+            if (!cookies[i].has_value())
+                continue;
+
+            xcb_generic_error_t* error = nullptr;
+            std::unique_ptr<xcb_intern_atom_reply_t> reply(
+                xcb_intern_atom_reply(m_conn.get(), cookies[i].value(), &error));
+            wake_up();
+            if (error != nullptr || !reply)
+                discard_replies(cookies, i + 1);
+            handle_generic_error(error, "Cannot create atom with name '" + names[i] + "'");
+            if (!reply)
+                throw exception("Cannot create atom with name '" + names[i] + "' (connection to X server is broken)");
+
+            atoms[i] = reply->atom;
+            cache.insert(m_display_name, names[i], reply->atom);
+        }
+
+        return atoms;
+    }
+
+    // only stats need these names, so their round trips are not counted
+    std::vector<std::string> get_atom_names(const std::vector<Atom> &atoms) {
+        std::vector<xcb_get_atom_name_cookie_t> cookies;
+        for (Atom atom : atoms)
+            cookies.push_back(xcb_get_atom_name(m_conn.get(), atom));
+
+        std::vector<std::string> names;
+        for (xcb_get_atom_name_cookie_t cookie : cookies) {
+            xcb_generic_error_t* error = nullptr;
+            std::unique_ptr<xcb_get_atom_name_reply_t> reply(xcb_get_atom_name_reply(m_conn.get(), cookie, &error));
+            std::unique_ptr<xcb_generic_error_t> error_ptr(error);
+            if (!reply) {
+                names.emplace_back();
+                continue;
+            }
+            names.emplace_back(xcb_get_atom_name_name(reply.get()), xcb_get_atom_name_name_length(reply.get()));
+        }
+        wake_up();
+        return names;
+    }
 
-        return reply->atom;
+    // X server silently ignores the request when `time` is older than the last change of selection
+    void set_selection_owner(Atom selection, xcb_timestamp_t time) {
+        xcb_set_selection_owner(m_conn.get(), m_window, selection, time);
+        xcb_flush(m_conn.get());
     }
 
-    void become_selection_owner(Atom selection) {
-        xcb_void_cookie_t cookie = xcb_set_selection_owner_checked(m_conn.get(), m_window, selection, XCB_CURRENT_TIME);
-        handle_generic_error(xcb_request_check(m_conn.get(), cookie), "Cannot become owner of clipboard selection");
+    // appending nothing to a property makes X server report its current time with a PropertyNotify event
+    void request_timestamp(Atom property) {
+        xcb_change_property(m_conn.get(), XCB_PROP_MODE_APPEND, m_window, property, XCB_ATOM_INTEGER, 32, 0, nullptr);
         xcb_flush(m_conn.get());
     }
 
-    std::optional<std::unique_ptr<Event>> get_latest_event() {
-        std::unique_ptr<xcb_generic_event_t> event(xcb_poll_for_event(m_conn.get()));
+    // latest server time that X server reported with an event, zero (current time) until the first one arrives
+    xcb_timestamp_t get_last_timestamp() const { return m_last_timestamp; }
 
-        // TODO: find a workaround for this
-        assert(m_conn != nullptr);
+    // returns when the connection has something to read, `wake_up` gets called or deadline passes
+    void wait_for_events(std::optional<std::chrono::steady_clock::time_point> deadline) {
+        xcb_flush(m_conn.get());
 
-        if (!event)
-            return std::nullopt;
-        return convert_generic_event_to_event(std::move(event));
+        int timeout_ms = -1;
+        if (deadline.has_value()) {
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline.value() -
+                                                                          std::chrono::steady_clock::now());
+            timeout_ms = static_cast<int>(std::max<std::chrono::milliseconds::rep>(0, remaining.count()));
+        }
+
+        const int connection_fd = xcb_get_file_descriptor(m_conn.get());
+        std::array<pollfd, 2> fds = {pollfd{.fd = m_wakeup_fd.get(), .events = POLLIN, .revents = 0},
+                                     pollfd{.fd = connection_fd, .events = POLLIN, .revents = 0}};
+        // broken connection will report POLLHUP for ever, just wait for a wake up in that case
+        nfds_t fds_count = xcb_connection_has_error(m_conn.get()) ? 1 : fds.size();
+        if (poll(fds.data(), fds_count, timeout_ms) > 0 && fds[0].revents & POLLIN)
+            m_wakeup_fd.drain();
     }
 
+    // waiting for a reply may move events into xcb queue, which poll would not notice
+    void wake_up() const { m_wakeup_fd.notify(); }
+
+    // reads the connection when xcb has no event queued
+    std::optional<Event> get_latest_event() { return get_event(xcb_poll_for_event); }
+
+    // never reads the connection, so draining with it ends even under a flood of events
+    std::optional<Event> get_queued_event() { return get_event(xcb_poll_for_queued_event); }
+
     template <typename Container, typename ValueType = typename Container::value_type>
     void write_on_window_property(Window window, Atom property, Atom target, const Container &data) {
         xcb_change_property(m_conn.get(), XCB_PROP_MODE_REPLACE, window, property, target,
@@ -61,6 +174,12 @@ public:
         xcb_flush(m_conn.get());
     }
 
+    void listen_for_property_changes(Window window, bool enable) {
+        uint32_t mask_value = enable ? XCB_EVENT_MASK_PROPERTY_CHANGE : XCB_EVENT_MASK_NO_EVENT;
+        xcb_change_window_attributes(m_conn.get(), window, XCB_CW_EVENT_MASK, &mask_value);
+        xcb_flush(m_conn.get());
+    }
+
     void notify_window_property_change(Window window, Atom property, Atom target, Atom selection) {
         const xcb_selection_notify_event_t event{.response_type = XCB_SELECTION_NOTIFY,
                                                  .pad0 = 0,
@@ -76,26 +195,112 @@ public:
         xcb_flush(m_conn.get());
     }
 
-    void request_selection_data(Atom selection, Atom target, Atom result) {
-        xcb_convert_selection_checked(m_conn.get(), m_window, selection, target, result, XCB_CURRENT_TIME);
+    // XFixes reports every new owner of `selections` afterwards, false is returned when X server doesn't support it
+    bool listen_for_owner_changes(const std::vector<Atom> &selections) {
+        const xcb_query_extension_reply_t* extension =
+            xcb_get_extension_data(m_conn.get(), &xfixes::get_extension_id());
+        m_round_trips.add();
+        wake_up();
+        if (extension == nullptr || !extension->present)
+            return false;
+
+        // XFixes requests are refused until the version gets negotiated
+        xfixes::QueryVersionRequest version_request{0, 0, 0, xfixes::kClientMajorVersion,
+                                                    xfixes::kClientMinorVersion};
+        unsigned int sequence =
+            xfixes::send_request(m_conn.get(), version_request, xfixes::kQueryVersionOpcode, true);
+        xcb_generic_error_t* error = nullptr;
+        std::unique_ptr<xfixes::QueryVersionReply> reply(
+            static_cast<xfixes::QueryVersionReply*>(xcb_wait_for_reply(m_conn.get(), sequence, &error)));
+        m_round_trips.add();
+        wake_up();
+        std::unique_ptr<xcb_generic_error_t> error_ptr(error);
+        if (!reply)
+            return false;
+
+        m_xfixes_first_event = extension->first_event;
+        for (Atom selection : selections) {
+            xfixes::SelectSelectionInputRequest select_request{0, 0, 0, m_window, selection,
+                                                               xfixes::kSetSelectionOwnerMask |
+                                                                   xfixes::kSelectionWindowDestroyMask |
+                                                                   xfixes::kSelectionClientCloseMask};
+            xfixes::send_request(m_conn.get(), select_request, xfixes::kSelectSelectionInputOpcode, false);
+        }
         xcb_flush(m_conn.get());
+        return true;
     }
 
-    std::string get_our_property_value(Atom property) {
-        xcb_get_property_cookie_t cookie =
-            xcb_get_property(m_conn.get(), static_cast<uint8_t>(true), m_window, property, XCB_ATOM_ANY, 0, -1);
+    // none is returned when selection has no owner or the connection is broken
+    Window get_selection_owner(Atom selection) {
+        xcb_get_selection_owner_cookie_t cookie = xcb_get_selection_owner(m_conn.get(), selection);
 
         xcb_generic_error_t* error = nullptr;
-        std::unique_ptr<xcb_get_property_reply_t> reply(xcb_get_property_reply(m_conn.get(), cookie, &error));
+        std::unique_ptr<xcb_get_selection_owner_reply_t> reply(
+            xcb_get_selection_owner_reply(m_conn.get(), cookie, &error));
+        m_round_trips.add();
+        wake_up();
         std::unique_ptr<xcb_generic_error_t> error_ptr(error);
-        if (error != nullptr)
-            return std::string("");
+        if (!reply)
+            return XCB_WINDOW_NONE;
+        return reply->owner;
+    }
+
+    bool is_connection_broken() const { return xcb_connection_has_error(m_conn.get()) != 0; }
+
+    void request_selection_data(Atom selection, Atom target, Atom result) {
+        xcb_convert_selection(m_conn.get(), m_window, selection, target, result, XCB_CURRENT_TIME);
+        xcb_flush(m_conn.get());
+    }
+
+    // reads and deletes the property
+    Property get_our_property(Atom property) { return get_window_property(m_window, property, true); }
 
-        const char* data = reinterpret_cast<const char*>(xcb_get_property_value(reply.get()));
-        uint32_t length = xcb_get_property_value_length(reply.get());
-        return std::string(data, length);
+    // same as `get_our_property` but each window of the value is handed to `consumer` as soon as it arrives
+    bool read_our_property(Atom property, const PropertyConsumer &consumer) {
+        return read_window_property(m_window, property, true, consumer);
     }
 
+    Property get_window_property(Window window, Atom property, bool remove) {
+        Property result{XCB_ATOM_NONE, std::string()};
+        const auto append = [&result](Atom type, const char* data, size_t size, size_t bytes_after) {
+            result.type = type;
+            if (result.value.capacity() < result.value.size() + size + bytes_after)
+                result.value.reserve(result.value.size() + size + bytes_after);
+            result.value.append(data, size);
+        };
+        bool succeeded = read_window_property(window, property, remove, append);
+        return succeeded ? result : Property{XCB_ATOM_NONE, std::string()};
+    }
+
+    // the property only gets deleted with the last window, consumer is called at least once unless reading fails
+    bool read_window_property(Window window, Atom property, bool remove, const PropertyConsumer &consumer) {
+        uint32_t offset = 0;
+
+        while (true) {
+            xcb_get_property_cookie_t cookie =
+                xcb_get_property(m_conn.get(), static_cast<uint8_t>(remove), window, property, XCB_ATOM_ANY,
+                                 offset / 4, kGetPropertyWindowSize / 4);
+
+            xcb_generic_error_t* error = nullptr;
+            std::unique_ptr<xcb_get_property_reply_t> reply(xcb_get_property_reply(m_conn.get(), cookie, &error));
+            m_round_trips.add();
+            wake_up();
+            std::unique_ptr<xcb_generic_error_t> error_ptr(error);
+            if (error != nullptr)
+                return false;
+
+            const char* data = reinterpret_cast<const char*>(xcb_get_property_value(reply.get()));
+            uint32_t length = xcb_get_property_value_length(reply.get());
+            consumer(reply->type, data, length, reply->bytes_after);
+
+            if (reply->bytes_after == 0 || length == 0)
+                return true;
+            offset += length;
+        }
+    }
+
+    uint64_t get_round_trip_count() const { return m_round_trips.get(); }
+
 private:
     class XcbConnectionDeleter {
     public:
@@ -126,6 +331,24 @@ private:
         return window;
     }
 
+    // ':0' and ':0.0' are the same X server
+    std::string get_display_name() const {
+        char* host = nullptr;
+        int display = 0;
+        if (!xcb_parse_display(nullptr, &host, &display, nullptr))
+            return std::string();
+
+        std::string result = std::string(host) + ":" + std::to_string(display);
+        free(host);
+        return result;
+    }
+
+    void discard_replies(const std::vector<std::optional<xcb_intern_atom_cookie_t>> &cookies, size_t start) const {
+        for (size_t i = start; i < cookies.size(); i++)
+            if (cookies[i].has_value())
+                xcb_discard_reply(m_conn.get(), cookies[i]->sequence);
+    }
+
     xcb_screen_t* get_root_screen(xcb_connection_t* conn) const {
         const xcb_setup_t* setup_info = xcb_get_setup(conn);
         xcb_screen_iterator_t screens = xcb_setup_roots_iterator(setup_info);
@@ -138,39 +361,78 @@ private:
             throw XcbException(error_msg, error_ptr->error_code);
     }
 
-    std::unique_ptr<Event> convert_generic_event_to_event(std::unique_ptr<xcb_generic_event_t> event) {
+    // events we don't handle are skipped, xcb allocates every event it reads but ours are only copied out of it
+    std::optional<Event> get_event(xcb_generic_event_t* (*poll_for_event)(xcb_connection_t*)) {
+        // TODO: find a workaround for this
+        assert(m_conn != nullptr);
+
+        while (true) {
+            std::unique_ptr<xcb_generic_event_t> event(poll_for_event(m_conn.get()));
+            if (!event)
+                return std::nullopt;
+
+            std::optional<Event> converted = convert_generic_event_to_event(event.get());
+            if (converted.has_value())
+                return converted;
+        }
+    }
+
+    std::optional<Event> convert_generic_event_to_event(const xcb_generic_event_t* event) {
         uint8_t event_type = event->response_type & ~kFilterXcbEventType;
+
+        // selection owner has been changed, event numbers of extensions are only known at runtime
+        uint8_t xfixes_first_event = m_xfixes_first_event;
+        if (xfixes_first_event != 0 && event_type == xfixes_first_event + xfixes::kSelectionNotifyEvent) {
+            const auto* owner_event = reinterpret_cast<const xfixes::SelectionNotifyEvent*>(event);
+            m_last_timestamp = owner_event->timestamp;
+            return OwnerChangeEvent(owner_event->selection, owner_event->owner, owner_event->selection_timestamp);
+        }
+
         switch (event_type) {
         // someone requested clipboard data
         case XCB_SELECTION_REQUEST: {
-            xcb_selection_request_event_t* sel_request_event =
-                reinterpret_cast<xcb_selection_request_event_t*>(event.get());
-            return std::make_unique<RequestSelectionEvent>(sel_request_event->requestor, sel_request_event->owner,
-                                                           sel_request_event->selection, sel_request_event->target,
-                                                           sel_request_event->property);
+            const auto* sel_request_event = reinterpret_cast<const xcb_selection_request_event_t*>(event);
+            return RequestSelectionEvent(sel_request_event->requestor, sel_request_event->owner,
+                                         sel_request_event->selection, sel_request_event->target,
+                                         sel_request_event->property);
         }
 
         // we are no longer owner of clipboard
         case XCB_SELECTION_CLEAR: {
-            xcb_selection_clear_event_t* sel_clear_event = reinterpret_cast<xcb_selection_clear_event_t*>(event.get());
-            return std::make_unique<SelectionClearEvent>(sel_clear_event->selection);
+            const auto* sel_clear_event = reinterpret_cast<const xcb_selection_clear_event_t*>(event);
+            m_last_timestamp = sel_clear_event->time;
+            return SelectionClearEvent(sel_clear_event->selection, sel_clear_event->time);
         }
 
         // our selection has been changed
         case XCB_SELECTION_NOTIFY: {
-            xcb_selection_notify_event_t* sel_notify_event =
-                reinterpret_cast<xcb_selection_notify_event_t*>(event.get());
-            return std::make_unique<SelectionNotifyEvent>(sel_notify_event->requestor, sel_notify_event->selection,
-                                                          sel_notify_event->target, sel_notify_event->property);
+            const auto* sel_notify_event = reinterpret_cast<const xcb_selection_notify_event_t*>(event);
+            return SelectionNotifyEvent(sel_notify_event->requestor, sel_notify_event->selection,
+                                        sel_notify_event->target, sel_notify_event->property);
+        }
+
+        // property of a window that we listen to has been changed
+        case XCB_PROPERTY_NOTIFY: {
+            const auto* prop_notify_event = reinterpret_cast<const xcb_property_notify_event_t*>(event);
+            m_last_timestamp = prop_notify_event->time;
+            return PropertyNotifyEvent(prop_notify_event->window, prop_notify_event->atom,
+                                       static_cast<PropertyNotifyEvent::State>(prop_notify_event->state),
+                                       prop_notify_event->time);
         }
 
         default:
-            return std::make_unique<Event>(Event::Type::kNone);
+            return std::nullopt;
         }
     }
 
     const XcbConnectionPtr m_conn;
     const xcb_window_t m_window;
+    const std::string m_display_name;
+    const EventFd m_wakeup_fd;
+    std::atomic<uint8_t> m_xfixes_first_event = 0; // zero until we listen for owner changes
+    // only times that X server itself puts in events, requestors may send anything in theirs
+    std::atomic<xcb_timestamp_t> m_last_timestamp = XCB_CURRENT_TIME;
+    Counter m_round_trips;
 };
 
 } // namespace xcb
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <variant>
 #include <xcb/xcb.h>
 
 namespace clipboardxx {
@@ -8,44 +9,59 @@ namespace xcb {
 using Atom = xcb_atom_t;
 using Window = xcb_window_t;
 
-class Event {
-public:
-    enum Type { kNone = 0, kRequestSelection, kSelectionClear, kSelectionNotify };
-
-    Event(Type type) : m_type(type) {}
-
-    Type get_type() const { return m_type; }
-
-private:
-    Type m_type;
-};
-
-class RequestSelectionEvent : public Event {
+class RequestSelectionEvent {
 public:
     RequestSelectionEvent(Window requestor, Window owner, Atom selection, Atom target, Atom property)
-        : Event(Type::kRequestSelection), m_requestor(requestor), m_owner(owner), m_selection(selection),
-          m_target(target), m_property(property) {}
+        : m_requestor(requestor), m_owner(owner), m_selection(selection), m_target(target), m_property(property) {}
 
     const Window m_requestor, m_owner;
     const Atom m_selection, m_target, m_property;
 };
 
-class SelectionNotifyEvent : public Event {
+class SelectionNotifyEvent {
 public:
     SelectionNotifyEvent(Window requestor, Atom selection, Atom target, Atom property)
-        : Event(Type::kSelectionNotify), m_requestor(requestor), m_selection(selection), m_target(target),
-          m_property(property) {}
+        : m_requestor(requestor), m_selection(selection), m_target(target), m_property(property) {}
 
     const Window m_requestor;
     const Atom m_selection, m_target, m_property;
 };
 
-class SelectionClearEvent : public Event {
+class SelectionClearEvent {
 public:
-    SelectionClearEvent(Atom selection) : Event(Type::kSelectionClear), m_selection(selection) {}
+    SelectionClearEvent(Atom selection, xcb_timestamp_t time) : m_selection(selection), m_time(time) {}
 
     const Atom m_selection;
+    const xcb_timestamp_t m_time; // when the new owner got the selection
 };
 
+class PropertyNotifyEvent {
+public:
+    enum State { kNewValue = XCB_PROPERTY_NEW_VALUE, kDelete = XCB_PROPERTY_DELETE };
+
+    PropertyNotifyEvent(Window window, Atom property, State state, xcb_timestamp_t time)
+        : m_window(window), m_property(property), m_state(state), m_time(time) {}
+
+    const Window m_window;
+    const Atom m_property;
+    const State m_state;
+    const xcb_timestamp_t m_time;
+};
+
+// reported by XFixes for every new owner of a selection we listen to
+class OwnerChangeEvent {
+public:
+    OwnerChangeEvent(Atom selection, Window owner, xcb_timestamp_t timestamp)
+        : m_selection(selection), m_owner(owner), m_timestamp(timestamp) {}
+
+    const Atom m_selection;
+    const Window m_owner;
+    const xcb_timestamp_t m_timestamp;
+};
+
+// events live on the stack of the event thread, events we don't handle are never converted
+using Event = std::variant<RequestSelectionEvent, SelectionClearEvent, SelectionNotifyEvent, PropertyNotifyEvent,
+                           OwnerChangeEvent>;
+
 } // namespace xcb
 } // namespace clipboardxx
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <sys/uio.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+
+namespace clipboardxx {
+namespace xcb {
+namespace xfixes {
+
+// only the few parts of XFixes extension that we use are written here by hand, so libxcb-xfixes is not needed
+
+// selection events are part of version 1
+constexpr uint32_t kClientMajorVersion = 1;
+constexpr uint32_t kClientMinorVersion = 0;
+
+constexpr uint8_t kQueryVersionOpcode = 0;
+constexpr uint8_t kSelectSelectionInputOpcode = 2;
+constexpr uint8_t kSelectionNotifyEvent = 0;
+
+constexpr uint32_t kSetSelectionOwnerMask = 1;
+constexpr uint32_t kSelectionWindowDestroyMask = 2;
+constexpr uint32_t kSelectionClientCloseMask = 4;
+
+struct QueryVersionRequest {
+    uint8_t major_opcode;
+    uint8_t minor_opcode;
+    uint16_t length;
+    uint32_t client_major_version;
+    uint32_t client_minor_version;
+};
+
+struct QueryVersionReply {
+    uint8_t response_type;
+    uint8_t pad0;
+    uint16_t sequence;
+    uint32_t length;
+    uint32_t major_version;
+    uint32_t minor_version;
+    uint8_t pad1[16];
+};
+
+struct SelectSelectionInputRequest {
+    uint8_t major_opcode;
+    uint8_t minor_opcode;
+    uint16_t length;
+    xcb_window_t window;
+    xcb_atom_t selection;
+    uint32_t event_mask;
+};
+
+struct SelectionNotifyEvent {
+    uint8_t response_type;
+    uint8_t subtype;
+    uint16_t sequence;
+    xcb_window_t window;
+    xcb_window_t owner;
+    xcb_atom_t selection;
+    xcb_timestamp_t timestamp;
+    xcb_timestamp_t selection_timestamp;
+    uint8_t pad0[8];
+};
+
+inline xcb_extension_t &get_extension_id() {
+    static xcb_extension_t id = {"XFIXES", 0};
+    return id;
+}
+
+// xcb fills in the opcodes and length, returns sequence number of the request
+template <typename Request>
+unsigned int send_request(xcb_connection_t* conn, Request &request, uint8_t minor_opcode, bool has_reply) {
+    // xcb uses the two io vectors in front of request for itself
+    std::array<iovec, 3> parts = {};
+    parts[2].iov_base = &request;
+    parts[2].iov_len = sizeof(Request);
+
+    xcb_protocol_request_t protocol_request = {1, &get_extension_id(), minor_opcode, !has_reply};
+    return xcb_send_request(conn, has_reply ? XCB_REQUEST_CHECKED : 0, parts.data() + 2, &protocol_request);
+}
+
+} // namespace xfixes
+} // namespace xcb
+} // namespace clipboardxx
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+
+namespace clipboardxx {
+
+constexpr size_t kDefaultIncrChunkSize = 1024 * 1024;
+
+// X11 selections, Windows only has clipboard
+enum class selection { clipboard, primary, secondary };
+
+struct options {
+    // selection that clipboard copies to and pastes from, clipboards with different selections and
+    // `shared_backend` still share one connection
+    clipboardxx::selection selection = clipboardxx::selection::clipboard;
+
+    // X11 only, data larger than this is transferred in chunks of this size using ICCCM INCR protocol, gets
+    // clamped to the maximum request size of X server
+    size_t incr_chunk_size = kDefaultIncrChunkSize;
+
+    // X11 only, all clipboards created with this option share one connection, window and event thread, these are
+    // released when the last of them gets destroyed, the options of first one are used for all of them
+    bool shared_backend = false;
+
+    // X11 only, the last pasted data of each format is kept and reused until clipboard gets a new owner, which is
+    // tracked with XFixes extension so nothing gets cached on X servers without it
+    bool paste_cache = false;
+
+    // X11 only, data that is still owned when clipboard gets destroyed keeps being served, either by clipboard
+    // manager (CLIPBOARD_MANAGER protocol) or by a detached process that exits once somebody else copies, on Windows
+    // and on Linux without X server data always outlives the process, destroying the clipboard waits up to half a
+    // second for clipboard manager and failures are counted in `stats::persist_failures`
+    bool persist = false;
+};
+
+} // namespace clipboardxx
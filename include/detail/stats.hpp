@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace clipboardxx {
+
+// bucket `i` counts operations that took less than 2^i microseconds but not less than the previous bucket, the last
+// bucket also counts everything longer
+struct latency_histogram {
+    static constexpr size_t kBucketCount = 24;
+
+    std::array<uint64_t, kBucketCount> buckets{};
+
+    uint64_t count() const {
+        uint64_t result = 0;
+        for (uint64_t bucket : buckets)
+            result += bucket;
+        return result;
+    }
+
+    // upper bound of the bucket that `fraction` of operations fit in, e.g. 0.99 gives the 99th percentile
+    std::chrono::microseconds percentile(double fraction) const {
+        uint64_t wanted = static_cast<uint64_t>(fraction * static_cast<double>(count()));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBucketCount; i++) {
+            seen += buckets[i];
+            if (seen >= wanted && seen != 0)
+                return std::chrono::microseconds(uint64_t(1) << i);
+        }
+        return std::chrono::microseconds(0);
+    }
+};
+
+// what a clipboard backend has done since it got created, clipboards with `shared_backend` report the same numbers
+struct stats {
+    uint64_t copies = 0;
+    uint64_t pastes = 0;
+    uint64_t self_pastes = 0;      // answered from our own data without asking X server
+    uint64_t paste_cache_hits = 0; // answered from `options::paste_cache`
+    uint64_t paste_timeouts = 0;
+    uint64_t paste_cancellations = 0;
+    uint64_t round_trips = 0; // requests that had to wait for an answer of X server
+    uint64_t bytes_pasted = 0;
+    uint64_t bytes_served = 0;
+    uint64_t requests_served = 0;
+    uint64_t requests_refused = 0;
+    uint64_t persist_failures = 0; // destroyed clipboards of this process whose `options::persist` data got lost
+    std::unordered_map<std::string, uint64_t> requests_per_target;
+    latency_histogram paste_latency;   // from paste call to its result
+    latency_histogram request_latency; // answering one request of another application
+};
+
+// collected with relaxed atomics, so recording costs next to nothing and never takes a lock
+class LatencyRecorder {
+public:
+    void record(std::chrono::steady_clock::duration duration) {
+        uint64_t microseconds =
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+        size_t bucket = 0;
+        while (bucket + 1 < latency_histogram::kBucketCount && microseconds >= (uint64_t(1) << bucket))
+            bucket++;
+        m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    latency_histogram snapshot() const {
+        latency_histogram result;
+        for (size_t i = 0; i < latency_histogram::kBucketCount; i++)
+            result.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+        return result;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, latency_histogram::kBucketCount> m_buckets{};
+};
+
+class Counter {
+public:
+    void add(uint64_t value = 1) { m_value.fetch_add(value, std::memory_order_relaxed); }
+
+    uint64_t get() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_value = 0;
+};
+
+} // namespace clipboardxx
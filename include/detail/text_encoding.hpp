@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+    #define CLIPBOARDXX_X86_SIMD
+    #include <immintrin.h>
+#endif
+
+namespace clipboardxx {
+
+// runs of ASCII are copied as is, so they are scanned as wide as the cpu allows
+
+inline size_t count_ascii_scalar(const char* data, size_t size) {
+    constexpr uint64_t kHighBits = 0x8080808080808080;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        if ((word & kHighBits) != 0)
+            break;
+    }
+    while (i < size && static_cast<unsigned char>(data[i]) < 0x80)
+        i++;
+    return i;
+}
+
+#ifdef CLIPBOARDXX_X86_SIMD
+inline size_t count_ascii_sse2(const char* data, size_t size) {
+    size_t i = 0;
+    for (; i + sizeof(__m128i) <= size; i += sizeof(__m128i)) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        uint32_t non_ascii = static_cast<uint32_t>(_mm_movemask_epi8(block));
+        if (non_ascii != 0)
+            return i + static_cast<size_t>(__builtin_ctz(non_ascii));
+    }
+    return i + count_ascii_scalar(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) inline size_t count_ascii_avx2(const char* data, size_t size) {
+    size_t i = 0;
+    for (; i + sizeof(__m256i) <= size; i += sizeof(__m256i)) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        uint32_t non_ascii = static_cast<uint32_t>(_mm256_movemask_epi8(block));
+        if (non_ascii != 0)
+            return i + static_cast<size_t>(__builtin_ctz(non_ascii));
+    }
+    return i + count_ascii_sse2(data + i, size - i);
+}
+
+inline bool cpu_supports_avx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+// length of the leading run of ASCII bytes
+inline size_t count_ascii(const char* data, size_t size) {
+#ifdef CLIPBOARDXX_X86_SIMD
+    if (size >= sizeof(__m256i) && cpu_supports_avx2())
+        return count_ascii_avx2(data, size);
+    return count_ascii_sse2(data, size);
+#else
+    return count_ascii_scalar(data, size);
+#endif
+}
+
+inline bool is_ascii(std::string_view text) { return count_ascii(text.data(), text.size()) == text.size(); }
+
+struct Utf8Sequence {
+    size_t length; // zero when the sequence is not valid utf-8
+    char32_t code_point;
+};
+
+// overlong forms, surrogates and code points past U+10FFFF are all invalid
+inline Utf8Sequence decode_utf8_sequence(const char* data, size_t size) {
+    const unsigned char lead = static_cast<unsigned char>(data[0]);
+    size_t length = 0;
+    char32_t code_point = 0, smallest = 0;
+    if (lead < 0x80)
+        return Utf8Sequence{1, lead};
+    if ((lead & 0xE0) == 0xC0) {
+        length = 2;
+        code_point = lead & 0x1F;
+        smallest = 0x80;
+    } else if ((lead & 0xF0) == 0xE0) {
+        length = 3;
+        code_point = lead & 0x0F;
+        smallest = 0x800;
+    } else if ((lead & 0xF8) == 0xF0) {
+        length = 4;
+        code_point = lead & 0x07;
+        smallest = 0x10000;
+    } else {
+        return Utf8Sequence{0, 0};
+    }
+
+    if (size < length)
+        return Utf8Sequence{0, 0};
+    for (size_t i = 1; i < length; i++) {
+        const unsigned char continuation = static_cast<unsigned char>(data[i]);
+        if ((continuation & 0xC0) != 0x80)
+            return Utf8Sequence{0, 0};
+        code_point = (code_point << 6) | (continuation & 0x3F);
+    }
+
+    if (code_point < smallest || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF))
+        return Utf8Sequence{0, 0};
+    return Utf8Sequence{length, code_point};
+}
+
+// runs of non ASCII characters are decoded one by one, wide scans only pay off for ASCII
+
+inline bool is_valid_utf8(std::string_view text) {
+    size_t i = 0;
+    while (i < text.size()) {
+        if (static_cast<unsigned char>(text[i]) < 0x80) {
+            i += count_ascii(text.data() + i, text.size() - i);
+            continue;
+        }
+
+        Utf8Sequence sequence = decode_utf8_sequence(text.data() + i, text.size() - i);
+        if (sequence.length == 0)
+            return false;
+        i += sequence.length;
+    }
+    return true;
+}
+
+// ICCCM STRING is ISO-8859-1, characters it doesn't have and invalid bytes become '?'
+inline std::string utf8_to_latin1(std::string_view text) {
+    // never longer than the input
+    std::string result(text.size(), '\0');
+    char* output = result.data();
+    size_t i = 0;
+    while (i < text.size()) {
+        if (static_cast<unsigned char>(text[i]) < 0x80) {
+            size_t ascii = count_ascii(text.data() + i, text.size() - i);
+            std::memcpy(output, text.data() + i, ascii);
+            output += ascii;
+            i += ascii;
+            continue;
+        }
+
+        Utf8Sequence sequence = decode_utf8_sequence(text.data() + i, text.size() - i);
+        *output++ = sequence.length != 0 && sequence.code_point <= 0xFF ? static_cast<char>(sequence.code_point) : '?';
+        i += sequence.length != 0 ? sequence.length : 1;
+    }
+    result.resize(static_cast<size_t>(output - result.data()));
+    return result;
+}
+
+inline std::string latin1_to_utf8(std::string_view text) {
+    // every byte outside ASCII takes two, counted first so the result is allocated once with its exact size
+    size_t non_ascii = 0;
+    for (size_t i = count_ascii(text.data(), text.size()); i < text.size();) {
+        if (static_cast<unsigned char>(text[i]) < 0x80) {
+            i += count_ascii(text.data() + i, text.size() - i);
+        } else {
+            non_ascii++;
+            i++;
+        }
+    }
+
+    std::string result(text.size() + non_ascii, '\0');
+    char* output = result.data();
+    size_t i = 0;
+    while (i < text.size()) {
+        const unsigned char character = static_cast<unsigned char>(text[i]);
+        if (character < 0x80) {
+            size_t ascii = count_ascii(text.data() + i, text.size() - i);
+            std::memcpy(output, text.data() + i, ascii);
+            output += ascii;
+            i += ascii;
+            continue;
+        }
+
+        *output++ = static_cast<char>(0xC0 | (character >> 6));
+        *output++ = static_cast<char>(0x80 | (character & 0x3F));
+        i++;
+    }
+    return result;
+}
+
+} // namespace clipboardxx
@@ -1,10 +1,17 @@
 #pragma once
 
+#include "buffer.hpp"
 #include "exception.hpp"
 #include "interface.hpp"
+#include "options.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <string>
+#include <vector>
 
 #ifdef WINDOWS
     #include <windows.h>
@@ -13,18 +20,51 @@ namespace clipboardxx {
 
 class ClipboardWindows : public ClipboardInterface {
 public:
-    void copy(const std::string &text) const override {
+    // other options only tune X11 transfers, nothing to apply here
+    explicit ClipboardWindows(const options &opts) {
+        if (opts.selection != selection::clipboard)
+            throw exception("Windows only has clipboard selection");
+    }
+
+    void copy(buffer data) const override {
         OpenCloseClipboardRaii clipboard_raii;
 
         empty_clipboard();
-        std::unique_ptr<char, WindowsPtrDeleter> buffer = allocate_memory_with_size(text.size() + 1);
-        write_string_to_memory_null_terminated(text, buffer.get());
-        set_clipboard_data_from_memory(std::move(buffer));
+        std::unique_ptr<char, WindowsPtrDeleter> memory = allocate_memory_with_size(data.size() + 1);
+        write_string_to_memory_null_terminated(data, memory.get());
+        set_clipboard_data_from_memory(CF_TEXT, std::move(memory));
     }
 
-    std::string paste() const noexcept override {
+    // text mime types go to CF_TEXT, others are registered as custom clipboard formats under their own name
+    void copy(std::vector<mime_data> formats) const override {
+        OpenCloseClipboardRaii clipboard_raii;
+
+        empty_clipboard();
+        for (const mime_data &format : formats) {
+            if (is_text_format(format.mime_type)) {
+                std::unique_ptr<char, WindowsPtrDeleter> memory = allocate_memory_with_size(format.data.size() + 1);
+                write_string_to_memory_null_terminated(format.data, memory.get());
+                set_clipboard_data_from_memory(CF_TEXT, std::move(memory));
+            } else {
+                std::unique_ptr<char, WindowsPtrDeleter> memory =
+                    allocate_memory_with_size(sizeof(uint64_t) + format.data.size());
+                write_data_with_size_prefix(format.data, memory.get());
+                set_clipboard_data_from_memory(register_format(format.mime_type), std::move(memory));
+            }
+        }
+    }
+
+    buffer paste() const noexcept override {
+        OpenCloseClipboardRaii clipboard_raii;
+        return buffer(get_clipboard_data());
+    }
+
+    buffer paste(const std::string &mime_type) const override {
+        if (is_text_format(mime_type))
+            return paste();
+
         OpenCloseClipboardRaii clipboard_raii;
-        return get_clipboard_data();
+        return buffer(get_clipboard_data(register_format(mime_type)));
     }
 
 private:
@@ -83,13 +123,34 @@ private:
         return global;
     }
 
-    void write_string_to_memory_null_terminated(const std::string &text, char* memory) const {
-        std::copy(text.begin(), text.end(), memory);
+    void write_string_to_memory_null_terminated(const buffer &text, char* memory) const {
+        std::copy(text.data(), text.data() + text.size(), memory);
         memory[text.size()] = '\0';
     }
 
-    void set_clipboard_data_from_memory(std::unique_ptr<char, WindowsPtrDeleter> buffer) const {
-        if (SetClipboardData(CF_TEXT, buffer.get())) {
+    // size of global memory may be rounded up, so custom formats keep their exact size in front of the data
+    void write_data_with_size_prefix(const buffer &data, char* memory) const {
+        const uint64_t size = data.size();
+        std::memcpy(memory, &size, sizeof(size));
+        std::copy(data.data(), data.data() + data.size(), memory + sizeof(size));
+    }
+
+    static bool is_text_format(const std::string &mime_type) {
+        constexpr std::array<const char*, 5> text_formats = {"text/plain", "text/plain;charset=utf-8",
+                                                             "text/plain;charset=UTF-8", "UTF8_STRING", "STRING"};
+        return std::find(text_formats.begin(), text_formats.end(), mime_type) != text_formats.end();
+    }
+
+    // same name always gives the same format, so it is fine to register it on every use
+    UINT register_format(const std::string &mime_type) const {
+        UINT format = RegisterClipboardFormatA(mime_type.c_str());
+        if (!format)
+            throw WindowsException("Cannot register clipboard format");
+        return format;
+    }
+
+    void set_clipboard_data_from_memory(UINT format, std::unique_ptr<char, WindowsPtrDeleter> buffer) const {
+        if (SetClipboardData(format, buffer.get())) {
             // from now on the system owns the buffer
             buffer.release();
         } else {
@@ -103,6 +164,29 @@ private:
             return std::string("");
         return std::string(result);
     }
+
+    // data of custom formats starts with its size, see `write_data_with_size_prefix`, a size larger than the memory
+    // only gives what there is
+    std::string get_clipboard_data(UINT format) const {
+        HANDLE handle = GetClipboardData(format);
+        if (!handle)
+            return std::string("");
+
+        const char* data = reinterpret_cast<const char*>(GlobalLock(handle));
+        if (!data)
+            return std::string("");
+
+        std::string result;
+        const size_t memory_size = GlobalSize(handle);
+        uint64_t size = 0;
+        if (memory_size >= sizeof(size)) {
+            std::memcpy(&size, data, sizeof(size));
+            size = std::min<uint64_t>(size, memory_size - sizeof(size));
+            result.assign(data + sizeof(size), static_cast<size_t>(size));
+        }
+        GlobalUnlock(handle);
+        return result;
+    }
 };
 
 } // namespace clipboardxx
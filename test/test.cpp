@@ -3,11 +3,39 @@
 
 #include "utils.hpp"
 
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#ifdef LINUX
+    #include <atomic>
+    #include <cstdio>
+    #include <cstdlib>
+    #include <cstring>
+    #include <future>
+    #include <optional>
+    #include <sys/wait.h>
+    #include <thread>
+    #include <unistd.h>
+    #include <xcb/xcb.h>
+#endif
+
 constexpr size_t kSmallTextSize = 100;
 constexpr size_t kLargeTextSize = 10000;
+constexpr size_t kHugeTextSize = 4 * 1024 * 1024;
 
 class ClipboardTest : public testing::Test {
 protected:
+    void SetUp() override {
+#ifdef LINUX
+        // hosts without X server get the shared memory clipboard, which does nothing X11 specific
+        const char* display = std::getenv("DISPLAY");
+        const std::string name = testing::UnitTest::GetInstance()->current_test_info()->name();
+        if ((display == nullptr || display[0] == '\0') && name.find("InX11Linux") != std::string::npos)
+            GTEST_SKIP() << "no X server";
+#endif
+    }
+
     void expect_clipboard_data(const std::string &text) {
         /* using another instance because in x11 linux same instance owns clipboard and will
            not send request and just uses internal memory to access clipboard data */
@@ -51,6 +79,12 @@ TEST_F(ClipboardTest, CopyPasteLargeText) {
     expect_clipboard_data(random_text);
 }
 
+TEST_F(ClipboardTest, CopyPasteHugeText) {
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kHugeTextSize);
+    m_clipboard.copy(random_text);
+    expect_clipboard_data(random_text);
+}
+
 TEST_F(ClipboardTest, CopyPasteWithOperatorOverload) {
     const std::string text = "hello";
     m_clipboard << text;
@@ -66,6 +100,175 @@ TEST_F(ClipboardTest, PasteWhenYouAreClipboardOwner) {
     EXPECT_EQ(m_clipboard.paste(), random_text);
 }
 
+TEST_F(ClipboardTest, PasteToStreamWritesWholeData) {
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kLargeTextSize);
+    m_clipboard.copy(random_text);
+
+    const clipboardxx::clipboard clipboard;
+    std::ostringstream stream;
+    EXPECT_EQ(clipboard.paste_to(stream), random_text.size());
+    EXPECT_EQ(stream.str(), random_text);
+}
+
+TEST_F(ClipboardTest, CopyFilePasteItsContent) {
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kLargeTextSize);
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "clipboardxx_copy_file_test.txt";
+    std::ofstream(path, std::ios::binary) << random_text;
+
+    m_clipboard.copy_file(path.string());
+    expect_clipboard_data(random_text);
+    std::filesystem::remove(path);
+
+    EXPECT_THROW(m_clipboard.copy_file(path.string()), clipboardxx::exception);
+}
+
+TEST_F(ClipboardTest, CopyMovedStringPaste) {
+    std::string random_text = m_random_generator.generate_random_displayable_text(kLargeTextSize);
+    const std::string expected_text = random_text;
+    m_clipboard.copy(std::move(random_text));
+    expect_clipboard_data(expected_text);
+}
+
+TEST_F(ClipboardTest, CopyWithDeleterReleasesDataAfterClipboardGoesOutOfScope) {
+    const std::string text = "hello";
+    bool released = false;
+
+    {
+        clipboardxx::clipboard clipboard;
+        clipboard.copy(text.data(), text.size(), [&released](const char* /*data*/) { released = true; });
+        EXPECT_EQ(clipboard.paste(), text);
+    }
+
+    EXPECT_TRUE(released);
+}
+
+TEST_F(ClipboardTest, PasteIntoReusableStringKeepsItsMemory) {
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kSmallTextSize);
+    m_clipboard.copy(random_text);
+
+    std::string result;
+    result.reserve(kLargeTextSize);
+    const char* memory = result.data();
+    m_clipboard.paste(result);
+    EXPECT_EQ(result, random_text);
+    EXPECT_EQ(result.data(), memory);
+}
+
+TEST_F(ClipboardTest, PasteIntoCallerBufferReturnsFullSize) {
+    m_clipboard.copy("hello");
+
+    std::array<char, 3> result{};
+    EXPECT_EQ(m_clipboard.paste(result.data(), result.size()), 5);
+    EXPECT_EQ(std::string(result.data(), result.size()), "hel");
+}
+
+TEST_F(ClipboardTest, CopyAsyncPasteAsync) {
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kLargeTextSize);
+    m_clipboard.copy_async(random_text).get();
+
+    const clipboardxx::clipboard clipboard;
+    EXPECT_EQ(clipboard.paste_async().get(), random_text);
+}
+
+TEST_F(ClipboardTest, ManyPasteAsyncInFlight) {
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kSmallTextSize);
+    m_clipboard.copy(random_text);
+
+    const clipboardxx::clipboard clipboard;
+    std::vector<std::future<std::string>> results;
+    for (size_t i = 0; i < 20; i++)
+        results.push_back(clipboard.paste_async());
+    for (std::future<std::string> &result : results)
+        EXPECT_EQ(result.get(), random_text);
+}
+
+TEST_F(ClipboardTest, PasteAsyncWithCallback) {
+    m_clipboard.copy("hello");
+
+    const clipboardxx::clipboard clipboard;
+    std::promise<std::string> result;
+    clipboard.paste_async([&result](std::exception_ptr error, clipboardxx::buffer data) {
+        EXPECT_FALSE(error);
+        result.set_value(data.to_string());
+    });
+    EXPECT_EQ(result.get_future().get(), "hello");
+}
+
+TEST_F(ClipboardTest, PasteAsyncFailsWhenCancelled) {
+    m_clipboard.copy("hello");
+
+    const clipboardxx::clipboard clipboard;
+    clipboardxx::cancellation cancel;
+    cancel.cancel();
+    EXPECT_THROW(clipboard.paste_async(clipboardxx::kWaitForPasteDataTimeout, cancel).get(),
+                 clipboardxx::cancelled_exception);
+}
+
+TEST_F(ClipboardTest, RemovedCancellationListenerIsNotCalled) {
+    clipboardxx::cancellation cancel;
+    bool removed_called = false, kept_called = false;
+    uint64_t registration = cancel.on_cancel([&removed_called] { removed_called = true; });
+    cancel.on_cancel([&kept_called] { kept_called = true; });
+    cancel.remove_listener(registration);
+    cancel.cancel();
+    EXPECT_FALSE(removed_called);
+    EXPECT_TRUE(kept_called);
+}
+
+#ifdef CLIPBOARDXX_COROUTINES
+
+struct DetachedCoroutine {
+    struct promise_type {
+        DetachedCoroutine get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+DetachedCoroutine paste_with_coroutine(const clipboardxx::clipboard &clipboard, std::promise<std::string> &result) {
+    result.set_value(co_await clipboard.paste_awaitable());
+}
+
+TEST_F(ClipboardTest, PasteAwaitable) {
+    m_clipboard.copy("hello");
+
+    const clipboardxx::clipboard clipboard;
+    std::promise<std::string> result;
+    paste_with_coroutine(clipboard, result);
+    EXPECT_EQ(result.get_future().get(), "hello");
+}
+
+#endif
+
+TEST_F(ClipboardTest, RepeatedPastesFromSameOwnerFollowItsNewData) {
+    const clipboardxx::clipboard clipboard;
+    for (size_t i = 0; i < 3; i++) {
+        const std::string random_text = m_random_generator.generate_random_displayable_text(kSmallTextSize);
+        m_clipboard.copy(random_text);
+        EXPECT_EQ(clipboard.paste(), random_text);
+        EXPECT_EQ(clipboard.paste(), random_text);
+    }
+}
+
+TEST_F(ClipboardTest, CopyMultipleFormatsPasteEachOfThem) {
+    const std::string text = m_random_generator.generate_random_displayable_text(kSmallTextSize);
+    const std::string html = "<b>" + text + "</b>";
+    const std::vector<uint8_t> bytes = m_random_generator.generate_random_bytes(kLargeTextSize);
+    const std::string binary(bytes.begin(), bytes.end());
+    m_clipboard.copy({{"text/plain", clipboardxx::buffer(std::string(text))},
+                      {"text/html", clipboardxx::buffer(std::string(html))},
+                      {"application/x-clipboardxx-test", clipboardxx::buffer(std::string(binary))}});
+
+    const clipboardxx::clipboard clipboard;
+    EXPECT_EQ(clipboard.paste(), text);
+    EXPECT_EQ(clipboard.paste_mime("text/html"), html);
+    EXPECT_EQ(clipboard.paste_mime("application/x-clipboardxx-test"), binary);
+    EXPECT_EQ(clipboard.paste_mime("image/png"), "");
+    EXPECT_EQ(m_clipboard.paste_mime("text/html"), html);
+}
+
 TEST_F(ClipboardTest, PasteTextIsEmptyWhenNoDataIsAvailable) {
     // become clipboard owner and then close clipboard
     {
@@ -89,6 +292,633 @@ TEST_F(ClipboardTest, ClipboardDataGetLostAfterClipboardGoesOutOfScopeInX11Linux
     EXPECT_EQ(m_clipboard.paste(), "");
 }
 
+TEST_F(ClipboardTest, PersistedClipboardDataRemainsAfterClipboardGoesOutOfScopeInX11Linux) {
+    const std::string text = m_random_generator.generate_random_displayable_text(kSmallTextSize);
+    const std::string html = "<b>" + text + "</b>";
+
+    {
+        clipboardxx::options opts;
+        opts.persist = true;
+        clipboardxx::clipboard clipboard(opts);
+        clipboard.copy({{"text/plain", [text] { return clipboardxx::buffer(std::string(text)); }},
+                        {"text/html", [html] { return clipboardxx::buffer(std::string(html)); }}});
+    }
+
+    EXPECT_EQ(m_clipboard.paste(), text);
+    EXPECT_EQ(m_clipboard.paste_mime("text/html"), html);
+    EXPECT_EQ(m_clipboard.get_stats().persist_failures, 0u);
+
+    // whoever serves it now stops once somebody else copies
+    m_clipboard.copy("hello");
+    expect_clipboard_data("hello");
+}
+
+TEST_F(ClipboardTest, PasteFromAnotherInstanceDoesNotWaitForTimeoutInX11Linux) {
+    m_clipboard.copy("hello");
+
+    const clipboardxx::clipboard clipboard;
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+    EXPECT_EQ(clipboard.paste(), "hello");
+    EXPECT_LT(std::chrono::steady_clock::now() - start_time, clipboardxx::kWaitForPasteDataTimeout);
+}
+
+TEST_F(ClipboardTest, PasteBufferWhenYouAreClipboardOwnerSharesMemoryInX11Linux) {
+    const clipboardxx::buffer data(m_random_generator.generate_random_displayable_text(kLargeTextSize));
+    m_clipboard.copy(data);
+    EXPECT_EQ(m_clipboard.paste_buffer().data(), data.data());
+}
+
+TEST_F(ClipboardTest, CopyPasteInChunksWithSmallIncrChunkSizeInX11Linux) {
+    clipboardxx::options opts;
+    opts.incr_chunk_size = kSmallTextSize;
+    const clipboardxx::clipboard clipboard(opts);
+
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kLargeTextSize);
+    clipboard.copy(random_text);
+    expect_clipboard_data(random_text);
+}
+
+TEST_F(ClipboardTest, PasteToSinkGetsEachIncrementalChunkOnItsOwnInX11Linux) {
+    clipboardxx::options opts;
+    opts.incr_chunk_size = kSmallTextSize;
+    const clipboardxx::clipboard clipboard(opts);
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kLargeTextSize);
+    clipboard.copy(random_text);
+
+    std::string result;
+    size_t largest_piece = 0, pieces = 0;
+    size_t written = m_clipboard.paste_to([&](const char* data, size_t size) {
+        result.append(data, size);
+        largest_piece = std::max(largest_piece, size);
+        pieces++;
+    });
+    EXPECT_EQ(written, random_text.size());
+    EXPECT_EQ(result, random_text);
+    EXPECT_LE(largest_piece, kSmallTextSize);
+    EXPECT_GT(pieces, 1u);
+}
+
+TEST_F(ClipboardTest, PasteToFileDescriptorInX11Linux) {
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kLargeTextSize);
+    const clipboardxx::clipboard clipboard;
+    clipboard.copy(random_text);
+
+    std::FILE* file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    EXPECT_EQ(m_clipboard.paste_to(fileno(file)), random_text.size());
+    std::string result(random_text.size(), ' ');
+    std::rewind(file);
+    EXPECT_EQ(std::fread(result.data(), 1, result.size(), file), random_text.size());
+    std::fclose(file);
+    EXPECT_EQ(result, random_text);
+}
+
+TEST_F(ClipboardTest, TextEncodingsHandleLongAsciiRunsAndInvalidSequencesInLinux) {
+    const std::string ascii = m_random_generator.generate_random_displayable_text(kLargeTextSize);
+    EXPECT_TRUE(clipboardxx::is_valid_utf8(ascii + "h\xC3\xA9llo \xE2\x82\xAC" + ascii));
+    EXPECT_FALSE(clipboardxx::is_valid_utf8(ascii + "\xC0\xAF" + ascii)); // overlong '/'
+    EXPECT_FALSE(clipboardxx::is_valid_utf8(ascii + "\xED\xA0\x80")); // surrogate
+    EXPECT_FALSE(clipboardxx::is_valid_utf8(ascii + "\xE2\x82")); // truncated
+
+    EXPECT_EQ(clipboardxx::utf8_to_latin1(ascii + "h\xC3\xA9llo \xE2\x82\xAC" + ascii), ascii + "h\xE9llo ?" + ascii);
+    EXPECT_EQ(clipboardxx::latin1_to_utf8(ascii + "h\xE9llo" + ascii), ascii + "h\xC3\xA9llo" + ascii);
+}
+
+TEST_F(ClipboardTest, TextCopiedAsLatin1StringIsPastedAsUtf8InX11Linux) {
+    m_clipboard.copy({{"STRING", clipboardxx::buffer(std::string("h\xE9llo"))}});
+    expect_clipboard_data("h\xC3\xA9llo");
+}
+
+TEST_F(ClipboardTest, LazyDataIsProducedOnlyWhenPastedInX11Linux) {
+    const std::string html = "<b>" + m_random_generator.generate_random_displayable_text(kSmallTextSize) + "</b>";
+    std::atomic<size_t> memoized_count(0), produce_count(0);
+    m_clipboard.copy({{"text/html",
+                       [&] {
+                           memoized_count++;
+                           return clipboardxx::buffer(std::string(html));
+                       }},
+                      {"application/x-clipboardxx-test",
+                       [&] {
+                           produce_count++;
+                           return clipboardxx::buffer(std::string(html));
+                       },
+                       false}});
+    EXPECT_EQ(memoized_count, 0u);
+
+    const clipboardxx::clipboard clipboard;
+    for (size_t i = 0; i < 2; i++) {
+        EXPECT_EQ(clipboard.paste_mime("text/html"), html);
+        EXPECT_EQ(clipboard.paste_mime("application/x-clipboardxx-test"), html);
+    }
+    EXPECT_EQ(memoized_count, 1u);
+    EXPECT_EQ(produce_count, 2u);
+}
+
+TEST_F(ClipboardTest, ChangeListenerGetsNewOwnerOnCopyInX11Linux) {
+    std::promise<clipboardxx::change_event> change;
+    clipboardxx::cancellation cancel;
+    bool can_report_changes = m_clipboard.on_change(
+        [&](const clipboardxx::change_event &event) {
+            cancel.cancel();
+            change.set_value(event);
+        },
+        cancel);
+    if (!can_report_changes)
+        GTEST_SKIP() << "X server doesn't support XFixes";
+
+    const clipboardxx::clipboard clipboard;
+    clipboard.copy("hello");
+    std::future<clipboardxx::change_event> result = change.get_future();
+    ASSERT_EQ(result.wait_for(std::chrono::seconds(1)), std::future_status::ready);
+    EXPECT_NE(result.get().owner, 0u);
+}
+
+TEST_F(ClipboardTest, PasteCacheSharesDataUntilOwnerChangesInX11Linux) {
+    clipboardxx::options opts;
+    opts.paste_cache = true;
+    const clipboardxx::clipboard clipboard(opts);
+
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kLargeTextSize);
+    m_clipboard.copy(random_text);
+    const clipboardxx::buffer first_paste = clipboard.paste_buffer();
+    EXPECT_EQ(first_paste.view(), random_text);
+    if (clipboard.paste_buffer().data() != first_paste.data())
+        GTEST_SKIP() << "X server doesn't support XFixes";
+
+    m_clipboard.copy(random_text);
+    const clipboardxx::buffer after_copy = clipboard.paste_buffer();
+    EXPECT_EQ(after_copy.view(), random_text);
+    EXPECT_NE(after_copy.data(), first_paste.data());
+}
+
+TEST_F(ClipboardTest, SelectionsHaveIndependentDataInX11Linux) {
+    clipboardxx::options opts;
+    opts.selection = clipboardxx::selection::primary;
+    const clipboardxx::clipboard primary(opts);
+    opts.selection = clipboardxx::selection::secondary;
+    const clipboardxx::clipboard secondary(opts);
+
+    const std::string clipboard_text = m_random_generator.generate_random_displayable_text(kSmallTextSize);
+    const std::string primary_text = m_random_generator.generate_random_displayable_text(kSmallTextSize);
+    const std::string secondary_text = m_random_generator.generate_random_displayable_text(kSmallTextSize);
+    ASSERT_NE(primary_text, secondary_text);
+    m_clipboard.copy(clipboard_text);
+    primary.copy(primary_text);
+    secondary.copy(secondary_text);
+
+    opts.selection = clipboardxx::selection::primary;
+    EXPECT_EQ(clipboardxx::clipboard(opts).paste(), primary_text);
+    opts.selection = clipboardxx::selection::secondary;
+    EXPECT_EQ(clipboardxx::clipboard(opts).paste(), secondary_text);
+    expect_clipboard_data(clipboard_text);
+}
+
+TEST_F(ClipboardTest, StatsCountPastesAndServedRequestsInX11Linux) {
+    const clipboardxx::clipboard owner;
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kLargeTextSize);
+    owner.copy(random_text);
+
+    const clipboardxx::clipboard clipboard;
+    EXPECT_EQ(clipboard.paste(), random_text);
+    const clipboardxx::stats paste_stats = clipboard.get_stats();
+    EXPECT_EQ(paste_stats.pastes, 1u);
+    EXPECT_EQ(paste_stats.bytes_pasted, random_text.size());
+    EXPECT_EQ(paste_stats.paste_latency.count(), 1u);
+    EXPECT_GT(paste_stats.round_trips, 0u);
+
+    const clipboardxx::stats owner_stats = owner.get_stats();
+    EXPECT_EQ(owner_stats.copies, 1u);
+    EXPECT_EQ(owner_stats.requests_served, 2u);
+    EXPECT_EQ(owner_stats.requests_per_target.at("TARGETS"), 1u);
+    EXPECT_EQ(owner_stats.requests_per_target.at("UTF8_STRING"), 1u);
+    EXPECT_GE(owner_stats.bytes_served, random_text.size());
+    // taking a snapshot doesn't change it
+    EXPECT_EQ(owner.get_stats().round_trips, owner_stats.round_trips);
+}
+
+TEST_F(ClipboardTest, CopyingAgainWhileOwnerNeedsNoRoundTripInX11Linux) {
+    const clipboardxx::clipboard owner;
+    owner.copy_async("first").get();
+    const uint64_t round_trips = owner.get_stats().round_trips;
+    for (int i = 0; i < 10; i++)
+        owner.copy("copy " + std::to_string(i));
+    owner.copy_async("last").get();
+    EXPECT_EQ(owner.get_stats().round_trips, round_trips);
+    EXPECT_EQ(m_clipboard.paste(), "last");
+}
+
+TEST_F(ClipboardTest, RenewalsWhileEventThreadIsBusyAllFinishInX11Linux) {
+    constexpr size_t kCopyCount = 50;
+    const clipboardxx::clipboard owner;
+    owner.copy_async("first").get();
+
+    // owner keeps serving a requestor, so property changes of the renewals arrive while event thread is in the
+    // middle of handling other events
+    std::atomic<bool> stop_requestor = false;
+    std::thread requestor([&stop_requestor] {
+        const clipboardxx::clipboard clipboard;
+        while (!stop_requestor)
+            clipboard.paste();
+    });
+
+    size_t finished_copies = 0;
+    for (; finished_copies < kCopyCount; finished_copies++) {
+        const std::string text = "copy " + std::to_string(finished_copies);
+        owner.copy(text);
+        if (owner.copy_async(text).wait_for(std::chrono::seconds(1)) != std::future_status::ready)
+            break;
+    }
+    stop_requestor = true;
+    requestor.join();
+
+    ASSERT_EQ(finished_copies, kCopyCount);
+    EXPECT_EQ(m_clipboard.paste(), "copy " + std::to_string(kCopyCount - 1));
+}
+
+// another X client that takes CLIPBOARD without anything of this library knowing about it
+class ForeignSelectionOwner {
+public:
+    ForeignSelectionOwner() : m_conn(xcb_connect(nullptr, nullptr)) {
+        const xcb_screen_t* screen = xcb_setup_roots_iterator(xcb_get_setup(m_conn)).data;
+        m_window = xcb_generate_id(m_conn);
+        xcb_create_window(m_conn, XCB_COPY_FROM_PARENT, m_window, screen->root, 0, 0, 1, 1, 0,
+                          XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, 0, nullptr);
+        m_clipboard = intern_atom("CLIPBOARD");
+    }
+
+    ~ForeignSelectionOwner() { xcb_disconnect(m_conn); }
+
+    xcb_atom_t intern_atom(const std::string &name) {
+        xcb_intern_atom_reply_t* reply = xcb_intern_atom_reply(
+            m_conn, xcb_intern_atom(m_conn, 0, static_cast<uint16_t>(name.size()), name.c_str()), nullptr);
+        xcb_atom_t atom = reply->atom;
+        free(reply);
+        return atom;
+    }
+
+    // returns once X server made us the owner
+    void take_clipboard() {
+        xcb_set_selection_owner(m_conn, m_window, m_clipboard, XCB_CURRENT_TIME);
+        free(xcb_get_selection_owner_reply(m_conn, xcb_get_selection_owner(m_conn, m_clipboard), nullptr));
+    }
+
+    // offers `refused` and `answered` targets but refuses every conversion to `refused`, the first answer is held
+    // until a conversion to `refused` is waiting as well so that the refusal comes first
+    void serve(xcb_atom_t answered, xcb_atom_t refused, const std::string &text, std::promise<void> &answer_held,
+               const std::atomic<bool> &stop) {
+        const xcb_atom_t targets = intern_atom("TARGETS");
+        std::optional<xcb_selection_request_event_t> held_answer, held_refusal;
+        bool both_answered = false;
+        while (!stop) {
+            xcb_generic_event_t* event = xcb_poll_for_event(m_conn);
+            if (event == nullptr) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            if ((event->response_type & ~0x80) == XCB_SELECTION_REQUEST) {
+                auto request = *reinterpret_cast<xcb_selection_request_event_t*>(event);
+                if (request.target == targets) {
+                    std::vector<xcb_atom_t> offered = {targets, refused, answered};
+                    xcb_change_property(m_conn, XCB_PROP_MODE_REPLACE, request.requestor, request.property,
+                                        XCB_ATOM_ATOM, 32, static_cast<uint32_t>(offered.size()), offered.data());
+                    notify(request, request.property);
+                } else if (request.target == answered) {
+                    held_answer = request;
+                    if (!both_answered)
+                        answer_held.set_value();
+                } else if (both_answered) {
+                    notify(request, XCB_ATOM_NONE);
+                } else {
+                    held_refusal = request;
+                }
+            }
+            free(event);
+
+            if (!held_answer.has_value() || (!both_answered && !held_refusal.has_value()))
+                continue;
+            if (held_refusal.has_value())
+                notify(*held_refusal, XCB_ATOM_NONE);
+            xcb_change_property(m_conn, XCB_PROP_MODE_REPLACE, held_answer->requestor, held_answer->property,
+                                held_answer->target, 8, static_cast<uint32_t>(text.size()), text.data());
+            notify(*held_answer, held_answer->property);
+            held_answer.reset();
+            held_refusal.reset();
+            both_answered = true;
+        }
+    }
+
+private:
+    void notify(const xcb_selection_request_event_t &request, xcb_atom_t property) {
+        xcb_selection_notify_event_t notification = {};
+        notification.response_type = XCB_SELECTION_NOTIFY;
+        notification.time = request.time;
+        notification.requestor = request.requestor;
+        notification.selection = request.selection;
+        notification.target = request.target;
+        notification.property = property;
+        xcb_send_event(m_conn, 0, request.requestor, XCB_EVENT_MASK_NO_EVENT, reinterpret_cast<char*>(&notification));
+        xcb_flush(m_conn);
+    }
+
+    xcb_connection_t* m_conn;
+    xcb_window_t m_window;
+    xcb_atom_t m_clipboard;
+};
+
+TEST_F(ClipboardTest, RenewalAfterAnotherClientTookSelectionOwnsItAgainInX11Linux) {
+    const clipboardxx::clipboard owner;
+    std::promise<void> callback_started, release_callback;
+    std::shared_future<void> released = release_callback.get_future().share();
+    owner.copy_async(clipboardxx::buffer(std::string("first")), [&callback_started, released](std::exception_ptr) {
+        callback_started.set_value();
+        released.wait();
+    });
+    callback_started.get_future().wait();
+
+    // event thread is held in the callback, so the clear of the foreign claim is still queued when we renew
+    ForeignSelectionOwner foreign_owner;
+    foreign_owner.take_clipboard();
+    std::future<void> renewal = owner.copy_async("second");
+    release_callback.set_value();
+
+    ASSERT_EQ(renewal.wait_for(std::chrono::seconds(1)), std::future_status::ready);
+    renewal.get();
+    EXPECT_EQ(m_clipboard.paste(), "second");
+}
+
+TEST_F(ClipboardTest, RefusalGoesToPasteOfRefusedTargetInX11Linux) {
+    ForeignSelectionOwner foreign_owner;
+    foreign_owner.take_clipboard();
+    std::promise<void> answer_held;
+    std::atomic<bool> stop = false;
+    std::thread server([&foreign_owner, &answer_held, &stop] {
+        foreign_owner.serve(foreign_owner.intern_atom("text/html"), foreign_owner.intern_atom("UTF8_STRING"),
+                            "<b>html</b>", answer_held, stop);
+    });
+
+    // the refused paste is the later one, so answering in order would give its refusal to the html paste
+    std::future<std::string> html =
+        std::async(std::launch::async, [this] { return m_clipboard.paste_mime("text/html"); });
+    answer_held.get_future().wait();
+    std::future<std::string> text = std::async(std::launch::async, [this] { return m_clipboard.paste(); });
+    EXPECT_EQ(html.get(), "<b>html</b>");
+    EXPECT_EQ(text.get(), "");
+    stop = true;
+    server.join();
+}
+
+TEST_F(ClipboardTest, PasteSeveralFormatsInOneMultipleRequestInX11Linux) {
+    clipboardxx::options opts;
+    opts.incr_chunk_size = 1000;
+    const clipboardxx::clipboard owner(opts);
+    const std::string text = m_random_generator.generate_random_displayable_text(kSmallTextSize);
+    const std::string html = "<b>" + m_random_generator.generate_random_displayable_text(kLargeTextSize) + "</b>";
+    owner.copy({{"text/plain", clipboardxx::buffer(std::string(text))},
+                {"text/html", clipboardxx::buffer(std::string(html))}});
+
+    const clipboardxx::clipboard clipboard;
+    std::vector<clipboardxx::mime_data> pasted =
+        clipboard.paste_mimes({"text/html", "image/png", "UTF8_STRING", "TARGETS"});
+    ASSERT_EQ(pasted.size(), 4u);
+    EXPECT_EQ(pasted.at(0).mime_type, "text/html");
+    EXPECT_EQ(pasted.at(0).data.to_string(), html);
+    EXPECT_TRUE(pasted.at(1).data.empty());
+    EXPECT_EQ(pasted.at(2).data.to_string(), text);
+    EXPECT_FALSE(pasted.at(3).data.empty());
+
+    const clipboardxx::stats owner_stats = owner.get_stats();
+    EXPECT_EQ(owner_stats.requests_per_target.at("MULTIPLE"), 1u);
+    EXPECT_EQ(owner_stats.requests_per_target.count("text/html"), 0u);
+
+    std::vector<clipboardxx::mime_data> self_pasted = owner.paste_mimes({"text/html", "text/plain"});
+    EXPECT_EQ(self_pasted.at(0).data.to_string(), html);
+    EXPECT_EQ(self_pasted.at(1).data.to_string(), text);
+}
+
+TEST_F(ClipboardTest, PasteNoFormatsFromAnotherOwnerInX11Linux) {
+    m_clipboard.copy("hello");
+
+    const clipboardxx::clipboard clipboard;
+    EXPECT_TRUE(clipboard.paste_mimes({}).empty());
+    EXPECT_EQ(clipboard.paste(), "hello");
+}
+
+TEST_F(ClipboardTest, ServingSlowRequestorDoesNotBlockOwnerInX11Linux) {
+    std::promise<void> producing, release;
+    std::shared_future<void> released = release.get_future().share();
+    m_clipboard.copy({{"text/html", [&producing, released] {
+                           producing.set_value();
+                           released.wait();
+                           return clipboardxx::buffer(std::string("<b>slow</b>"));
+                       }}});
+
+    // requestor keeps getting data of the copy it asked for, even though a newer one replaces it meanwhile
+    const clipboardxx::clipboard clipboard;
+    std::future<std::string> slow_paste =
+        std::async(std::launch::async, [&clipboard] { return clipboard.paste_mime("text/html"); });
+    producing.get_future().wait();
+
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kSmallTextSize);
+    std::future<std::string> self_paste = std::async(std::launch::async, [this, &random_text] {
+        m_clipboard.copy(random_text);
+        return m_clipboard.paste();
+    });
+    EXPECT_EQ(self_paste.wait_for(std::chrono::seconds(2)), std::future_status::ready);
+    release.set_value();
+    EXPECT_EQ(self_paste.get(), random_text);
+    EXPECT_EQ(slow_paste.get(), "<b>slow</b>");
+}
+
+TEST_F(ClipboardTest, ServingBurstOfRequestorsInX11Linux) {
+    constexpr size_t kRequestorCount = 32;
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kSmallTextSize);
+    m_clipboard.copy(random_text);
+
+    std::vector<std::unique_ptr<clipboardxx::clipboard>> requestors;
+    for (size_t i = 0; i < kRequestorCount; i++) {
+        requestors.push_back(std::make_unique<clipboardxx::clipboard>());
+        requestors.back()->warm_up();
+    }
+
+    const clipboardxx::stats before_burst = m_clipboard.get_stats();
+    std::vector<std::future<std::string>> results;
+    for (const std::unique_ptr<clipboardxx::clipboard> &requestor : requestors)
+        results.push_back(requestor->paste_async());
+    for (std::future<std::string> &result : results)
+        EXPECT_EQ(result.get(), random_text);
+
+    // every requestor got its data from the owner with exactly one conversion
+    const auto get_text_requests = [](const clipboardxx::stats &stats) -> uint64_t {
+        auto found = stats.requests_per_target.find("UTF8_STRING");
+        return found == stats.requests_per_target.end() ? 0 : found->second;
+    };
+    const clipboardxx::stats after_burst = m_clipboard.get_stats();
+    EXPECT_EQ(get_text_requests(after_burst) - get_text_requests(before_burst), kRequestorCount);
+    EXPECT_EQ(after_burst.requests_refused, before_burst.requests_refused);
+    for (const std::unique_ptr<clipboardxx::clipboard> &requestor : requestors) {
+        const clipboardxx::stats requestor_stats = requestor->get_stats();
+        EXPECT_EQ(requestor_stats.pastes, 1u);
+        EXPECT_EQ(requestor_stats.bytes_pasted, random_text.size());
+    }
+}
+
+size_t get_thread_count() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+        if (line.rfind("Threads:", 0) == 0)
+            return std::stoul(line.substr(std::strlen("Threads:")));
+    return 0;
+}
+
+TEST_F(ClipboardTest, SharedBackendClipboardsShareDataAndThreadInX11Linux) {
+    clipboardxx::options opts;
+    opts.shared_backend = true;
+    const std::string random_text = m_random_generator.generate_random_displayable_text(kSmallTextSize);
+
+    auto first_clipboard = std::make_unique<clipboardxx::clipboard>(opts);
+    first_clipboard->warm_up();
+    size_t thread_count = get_thread_count();
+    std::vector<std::unique_ptr<clipboardxx::clipboard>> clipboards;
+    for (size_t i = 0; i < 10; i++) {
+        clipboards.push_back(std::make_unique<clipboardxx::clipboard>(opts));
+        clipboards.back()->warm_up();
+    }
+    EXPECT_EQ(get_thread_count(), thread_count);
+
+    first_clipboard->copy(random_text);
+    first_clipboard.reset();
+    EXPECT_EQ(clipboards.back()->paste(), random_text);
+    expect_clipboard_data(random_text);
+}
+
+TEST_F(ClipboardTest, ConstructingClipboardDoesNotConnectToXServerInX11Linux) {
+    const std::string display = std::getenv("DISPLAY");
+    setenv("DISPLAY", ":4242", 1);
+    const clipboardxx::clipboard clipboard;
+    EXPECT_EQ(clipboard.get_stats().round_trips, 0u);
+    EXPECT_THROW(clipboard.warm_up(), clipboardxx::exception);
+    // pasting reports the failed connection like copying does
+    for (const std::function<void()> &operation : std::vector<std::function<void()>>{
+             [&clipboard] { clipboard.paste(); }, [&clipboard] { clipboard.paste_mimes({"text/html"}); }}) {
+        try {
+            operation();
+            ADD_FAILURE() << "operation succeeded without X server";
+        } catch (const clipboardxx::exception &error) {
+            EXPECT_EQ(std::string(error.what()).rfind("XCB Error: ", 0), 0u) << error.what();
+        }
+    }
+    setenv("DISPLAY", display.c_str(), 1);
+
+    clipboard.warm_up();
+    clipboard.copy("hello");
+    EXPECT_EQ(m_clipboard.paste(), "hello");
+}
+
+// clipboards constructed meanwhile act like on a host without X server
+class WithoutDisplay {
+public:
+    WithoutDisplay() {
+        const char* display = std::getenv("DISPLAY");
+        if (display != nullptr)
+            m_display = display;
+        unsetenv("DISPLAY");
+    }
+
+    ~WithoutDisplay() {
+        if (m_display.has_value())
+            setenv("DISPLAY", m_display->c_str(), 1);
+    }
+
+private:
+    std::optional<std::string> m_display;
+};
+
+TEST_F(ClipboardTest, CopyPasteBetweenProcessesWithoutXServerInHeadlessLinux) {
+    const std::string text = m_random_generator.generate_random_displayable_text(kLargeTextSize);
+    const std::string html = "<b>" + text + "</b>";
+    WithoutDisplay without_display;
+
+    // data stays after the copying process is gone
+    pid_t child = fork();
+    if (child == 0) {
+        clipboardxx::clipboard clipboard;
+        clipboard.copy({{"text/plain", clipboardxx::buffer(std::string(text))},
+                        {"text/html", clipboardxx::buffer(std::string(html))}});
+        _exit(0);
+    }
+    int status = 0;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    const clipboardxx::clipboard clipboard;
+    const clipboardxx::buffer first_paste = clipboard.paste_buffer();
+    EXPECT_EQ(first_paste.view(), text);
+    EXPECT_EQ(clipboard.paste_mime("text/html"), html);
+    EXPECT_EQ(clipboard.paste_mime("image/png"), "");
+    // pasting again maps nothing new
+    EXPECT_EQ(clipboard.paste_buffer().data(), first_paste.data());
+    // several formats at once are a single paste
+    const uint64_t pastes = clipboard.get_stats().pastes;
+    EXPECT_EQ(clipboard.paste_mimes({"text/plain", "text/html"}).size(), 2u);
+    EXPECT_EQ(clipboard.get_stats().pastes, pastes + 1);
+
+    // data that was pasted before stays valid once a new copy replaces it
+    const clipboardxx::clipboard other_clipboard;
+    other_clipboard.copy("hello");
+    EXPECT_EQ(clipboard.paste(), "hello");
+    EXPECT_EQ(first_paste.view(), text);
+}
+
+TEST_F(ClipboardTest, DataOfProcessThatDiedWhileCopyingIsRemovedByNextCopyInHeadlessLinux) {
+    WithoutDisplay without_display;
+    const clipboardxx::clipboard clipboard;
+    clipboard.copy("first");
+
+    const std::string name = clipboardxx::kSharedMemoryNamePrefix + std::to_string(getuid()) + "-clipboard";
+    const auto get_data_name = [&name](uint64_t generation) { return name + "-" + std::to_string(generation); };
+    std::unique_ptr<clipboardxx::SharedMemory> state_memory =
+        clipboardxx::SharedMemory::open_or_create(name, sizeof(clipboardxx::SharedClipboardState));
+    auto* state = reinterpret_cast<clipboardxx::SharedClipboardState*>(state_memory->data());
+
+    // child takes a generation and dies before publishing it
+    const uint64_t abandoned = state->last_generation.load() + 1;
+    pid_t child = fork();
+    if (child == 0) {
+        state->last_generation.fetch_add(1);
+        clipboardxx::SharedMemory::create(get_data_name(abandoned), 64).release();
+        _exit(0);
+    }
+    int status = 0;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    ASSERT_NE(clipboardxx::SharedMemory::open_read_only(get_data_name(abandoned)), nullptr);
+
+    clipboard.copy("second");
+    EXPECT_EQ(clipboardxx::SharedMemory::open_read_only(get_data_name(abandoned)), nullptr);
+    EXPECT_EQ(clipboardxx::clipboard().paste(), "second");
+}
+
+TEST_F(ClipboardTest, ChangeListenerGetsCopiesOfOtherClipboardsInHeadlessLinux) {
+    WithoutDisplay without_display;
+    const clipboardxx::clipboard clipboard;
+    std::promise<clipboardxx::change_event> change;
+    std::atomic<bool> changed = false;
+    clipboardxx::cancellation cancel;
+    ASSERT_TRUE(clipboard.on_change(
+        [&change, &changed](const clipboardxx::change_event &event) {
+            if (!changed.exchange(true))
+                change.set_value(event);
+        },
+        cancel));
+
+    const clipboardxx::clipboard other_clipboard;
+    other_clipboard.copy("hello");
+    std::future<clipboardxx::change_event> result = change.get_future();
+    ASSERT_EQ(result.wait_for(std::chrono::seconds(1)), std::future_status::ready);
+    EXPECT_EQ(result.get().owner, static_cast<uint32_t>(getpid()));
+    cancel.cancel();
+}
+
 #elif defined(WINDOWS)
 
 TEST_F(ClipboardTest, ClipboardDataRemainsAfterClipboardGoesOutOfScopeInWindows) {
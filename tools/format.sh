@@ -7,4 +7,4 @@ fi
 source paths.sh
 
 set -x
-clang-format -style=file -i ${INCLUDE_FILES} ${TEST_FILES}
+clang-format -style=file -i ${INCLUDE_FILES} ${TEST_FILES} ${BENCH_FILES}
@@ -4,3 +4,4 @@ shopt -s globstar
 
 INCLUDE_FILES="../include/**/*.hpp"
 TEST_FILES="../test/*.hpp ../test/*.cpp"
+BENCH_FILES="../bench/*.cpp"